@@ -0,0 +1,43 @@
+/* File      : bench.hpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#ifndef _BENCH_H
+#define _BENCH_H
+
+
+namespace mrtp {
+
+/*
+Hardware cache misses of the calling thread, read with
+perf events. Counters that the kernel does not allow
+stay unavailable and read as -1.
+*/
+class CacheCounters {
+  public:
+    CacheCounters();
+    ~CacheCounters();
+    void start();
+    void stop();
+    long long get_l1_misses();
+    long long get_llc_misses();
+
+  private:
+    int l1fd_;
+    int llcfd_;
+    long long l1_;
+    long long llc_;
+};
+
+double wall_seconds();
+float next_random(unsigned long long *state);
+
+int bench_texture(int argc, char **argv);
+int bench_kernels(int argc, char **argv);
+int bench_scene(int argc, char **argv);
+int bench_scaling(int argc, char **argv);
+
+} //namespace mrtp
+
+#endif //_BENCH_H
@@ -0,0 +1,295 @@
+/* File      : kernels.cpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#include <Eigen/Geometry>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "cylinder.hpp"
+#include "plane.hpp"
+#include "sphere.hpp"
+#include "texture.hpp"
+
+
+namespace mrtp {
+
+static const int kRays = 1 << 16;
+static const int kRepeats = 16;
+static const int kTrials = 5;
+static const unsigned long long kSeed = 0x9e3779b97f4a7c15ULL;
+static const float kMaxDistance = 1000.0f;
+static const float kSlower = 1.1f;
+
+static const char *kTexture = "textures/02camino.png";
+
+/*
+Rays of a set and the coefficients of the quadratic of
+a unit sphere at the origin, as in Sphere::solve.
+*/
+struct RaySet {
+    std::vector<Eigen::Vector3f> origins;
+    std::vector<Eigen::Vector3f> directions;
+    std::vector<float> coeffs;
+};
+
+struct KernelResult {
+    std::string kernel;
+    std::string set;
+    long long calls;
+    long long hits;
+    double nanoseconds;
+};
+
+static Eigen::Vector3f random_unit(unsigned long long *state) {
+    float z = 2.0f * next_random(state) - 1.0f;
+    float angle = 2.0f * static_cast<float>(M_PI) * next_random(state);
+    float r = std::sqrt(1.0f - z * z);
+    return Eigen::Vector3f(r * std::cos(angle), r * std::sin(angle), z);
+}
+
+/*
+Rays from a sphere of radius 10 around the origin toward
+points near it, which hit a unit sphere or cylinder at
+the origin, or toward points farther out, which mostly
+miss them. Rays of planes start above the plane y=0 and
+head down to hit it, or up to miss it.
+*/
+static void generate_rays(bool hits, bool plane, unsigned long long seed, RaySet *set) {
+    unsigned long long state = seed;
+    float spread = (hits) ? 0.5f : 4.0f;
+
+    for (int k = 0; k < kRays; k++) {
+        Eigen::Vector3f origin = 10.0f * random_unit(&state);
+        Eigen::Vector3f target = spread * std::cbrt(next_random(&state)) * random_unit(&state);
+        if (plane) {
+            origin[1] = std::fabs(origin[1]) + 1.0f;
+            target *= 10.0f;
+            target[1] = (hits) ? 0.0f : 2.0f * origin[1];
+        }
+        Eigen::Vector3f direction = (target - origin).normalized();
+
+        set->origins.push_back(origin);
+        set->directions.push_back(direction);
+        set->coeffs.push_back(direction.dot(direction));
+        set->coeffs.push_back(2.0f * direction.dot(origin));
+        set->coeffs.push_back(origin.dot(origin) - 1.0f);
+    }
+}
+
+/*
+Times calls of kernel over a set, best of a few trials.
+Kernel makes all calls of one repeat and returns the
+number of hits.
+*/
+template <typename Kernel>
+static KernelResult time_kernel(const char *kernel, const char *set, long long calls,
+                                Kernel run) {
+    KernelResult result = {kernel, set, calls * kRepeats, 0, 0.0};
+    double best = -1.0;
+
+    for (int trial = 0; trial < kTrials; trial++) {
+        long long hits = 0;
+        double start = wall_seconds();
+        for (int r = 0; r < kRepeats; r++) { hits += run(); }
+        double elapsed = wall_seconds() - start;
+
+        if ((best < 0.0) || (elapsed < best)) { best = elapsed; }
+        result.hits = hits;
+    }
+    result.nanoseconds = 1.0e9 * best / static_cast<double>(result.calls);
+    return result;
+}
+
+static long long solve_actor(Actor *actor, RaySet *set) {
+    long long hits = 0;
+    for (int k = 0; k < kRays; k++) {
+        hits += actor->solve(&set->origins[k], &set->directions[k], 0.0f, kMaxDistance) > 0.0f;
+    }
+    return hits;
+}
+
+static long long solve_quadratics(RaySet *set) {
+    long long hits = 0;
+    const float *c = &set->coeffs[0];
+    for (int k = 0; k < kRays; k++, c += 3) {
+        hits += Actor::solve_quadratic(c[0], c[1], c[2], 0.0f, kMaxDistance) > 0.0f;
+    }
+    return hits;
+}
+
+/*
+Baseline lines hold a kernel, a set and nanoseconds per
+call, lines starting with # are comments.
+*/
+static bool read_baseline(const char *path, std::map<std::string, double> *baseline) {
+    std::ifstream file(path);
+    if (!file) { return false; }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || (line[0] == '#')) { continue; }
+        std::istringstream fields(line);
+        std::string kernel, set;
+        double nanoseconds;
+        if (fields >> kernel >> set >> nanoseconds) { (*baseline)[kernel + " " + set] = nanoseconds; }
+    }
+    return true;
+}
+
+static bool write_baseline(const char *path, std::vector<KernelResult> *results) {
+    std::ofstream file(path);
+    if (!file) { return false; }
+
+    file << "# kernel set ns/call, from mrtp_bench kernels -s" << std::endl;
+    for (size_t k = 0; k < results->size(); k++) {
+        KernelResult *result = &(*results)[k];
+        file << result->kernel << " " << result->set << " " << std::fixed
+             << std::setprecision(3) << result->nanoseconds << std::endl;
+    }
+    return static_cast<bool>(file);
+}
+
+/*
+Times intersection kernels of each primitive over rays
+that mostly hit and rays that mostly miss, and texture
+lookups of spheres and textures. Results are compared
+to a baseline with -c and saved as one with -s.
+*/
+int bench_kernels(int argc, char **argv) {
+    std::string compare, save;
+    for (int i = 0; i < argc; i++) {
+        std::string option(argv[i]);
+        if (((option == "-c") || (option == "-s")) && (i + 1 < argc)) {
+            ((option == "-c") ? compare : save) = argv[++i];
+        } else {
+            std::cerr << "unknown option: " << option << std::endl;
+            return 1;
+        }
+    }
+
+    std::map<std::string, double> baseline;
+    if ((!compare.empty()) && (!read_baseline(compare.c_str(), &baseline))) {
+        std::cerr << "cannot read baseline " << compare << std::endl;
+        return 1;
+    }
+
+    RaySet hit, miss, planehit, planemiss;
+    generate_rays(true, false, kSeed, &hit);
+    generate_rays(false, false, kSeed + 1, &miss);
+    generate_rays(true, true, kSeed + 2, &planehit);
+    generate_rays(false, true, kSeed + 3, &planemiss);
+
+    Eigen::Vector3f origin(0.0f, 0.0f, 0.0f);
+    Eigen::Vector3f axis(0.0f, 1.0f, 0.0f);
+    Sphere sphere(&origin, 1.0f, &axis, 0.0f, kTexture, tx_float);
+    Cylinder cylinder(&origin, &axis, 1.0f, 1.0f, 0.0f, kTexture, tx_float);
+    Plane plane(&origin, &axis, 1.0f, 0.0f, kTexture, tx_float);
+    textureCollector.load_pending();
+
+    Texture *texture = textureCollector.add(kTexture, tx_float);
+    if (!texture->is_loaded()) {
+        std::cerr << "cannot read texture " << kTexture << std::endl;
+        return 1;
+    }
+
+    // Hits and normals on the sphere, for its texture lookups
+    std::vector<Eigen::Vector3f> points, normals;
+    for (int k = 0; k < kRays; k++) {
+        float t = sphere.solve(&hit.origins[k], &hit.directions[k], 0.0f, kMaxDistance);
+        if (t <= 0.0f) { continue; }
+        points.push_back(hit.origins[k] + t * hit.directions[k]);
+        normals.push_back(sphere.calculate_normal(&points.back()));
+    }
+    long long npoints = static_cast<long long>(points.size());
+
+    // Texture coordinates along rows, and scattered
+    std::vector<float> rows, scattered;
+    unsigned long long state = kSeed + 4;
+    for (int k = 0; k < kRays; k++) {
+        rows.push_back(static_cast<float>(k % 256) / 256.0f);
+        rows.push_back(static_cast<float>(k / 256) / 256.0f);
+        scattered.push_back(next_random(&state));
+        scattered.push_back(next_random(&state));
+    }
+    float checksum = 0.0f;
+
+    std::vector<KernelResult> results;
+    results.push_back(time_kernel("solve_quadratic", "hit", kRays,
+                                  [&] { return solve_quadratics(&hit); }));
+    results.push_back(time_kernel("solve_quadratic", "miss", kRays,
+                                  [&] { return solve_quadratics(&miss); }));
+    results.push_back(time_kernel("Sphere::solve", "hit", kRays,
+                                  [&] { return solve_actor(&sphere, &hit); }));
+    results.push_back(time_kernel("Sphere::solve", "miss", kRays,
+                                  [&] { return solve_actor(&sphere, &miss); }));
+    results.push_back(time_kernel("Cylinder::solve", "hit", kRays,
+                                  [&] { return solve_actor(&cylinder, &hit); }));
+    results.push_back(time_kernel("Cylinder::solve", "miss", kRays,
+                                  [&] { return solve_actor(&cylinder, &miss); }));
+    results.push_back(time_kernel("Plane::solve", "hit", kRays,
+                                  [&] { return solve_actor(&plane, &planehit); }));
+    results.push_back(time_kernel("Plane::solve", "miss", kRays,
+                                  [&] { return solve_actor(&plane, &planemiss); }));
+    results.push_back(time_kernel("Sphere::pick_pixel", "hit", npoints, [&] {
+        for (long long k = 0; k < npoints; k++) {
+            checksum += sphere.pick_pixel(&points[k], &normals[k], 0.0f)[0];
+        }
+        return npoints;
+    }));
+    results.push_back(time_kernel("Texture::pick_pixel", "rows", kRays, [&] {
+        for (size_t k = 0; k < rows.size(); k += 2) {
+            checksum += texture->pick_pixel(rows[k], rows[k + 1], 1.0f)[0];
+        }
+        return static_cast<long long>(kRays);
+    }));
+    results.push_back(time_kernel("Texture::pick_pixel", "scattered", kRays, [&] {
+        for (size_t k = 0; k < scattered.size(); k += 2) {
+            checksum += texture->pick_pixel(scattered[k], scattered[k + 1], 1.0f)[0];
+        }
+        return static_cast<long long>(kRays);
+    }));
+
+    std::cout << kRays << " rays per set, best of " << kTrials << " runs of " << kRepeats
+              << std::endl;
+    std::cout << "kernel               set          hits   ns/call   Mcalls/s";
+    if (!baseline.empty()) { std::cout << "  baseline  change"; }
+    std::cout << std::endl;
+
+    for (size_t k = 0; k < results.size(); k++) {
+        KernelResult *result = &results[k];
+        std::cout << std::left << std::setw(21) << result->kernel << std::setw(10) << result->set
+                  << std::right << std::fixed << std::setprecision(1) << std::setw(6)
+                  << 100.0 * result->hits / result->calls << "%" << std::setprecision(2)
+                  << std::setw(10) << result->nanoseconds << std::setw(11)
+                  << 1.0e3 / result->nanoseconds;
+
+        std::map<std::string, double>::iterator found =
+            baseline.find(result->kernel + " " + result->set);
+        if (found != baseline.end()) {
+            double change = result->nanoseconds / found->second;
+            std::cout << std::setw(10) << found->second << std::showpos << std::setw(7)
+                      << std::setprecision(0) << 100.0 * (change - 1.0) << "%" << std::noshowpos;
+            if (change > kSlower) { std::cout << "  slower"; }
+        }
+        std::cout << std::endl;
+    }
+
+    if ((!save.empty()) && (!write_baseline(save.c_str(), &results))) {
+        std::cerr << "cannot write baseline " << save << std::endl;
+        return 1;
+    }
+    // Keeps lookups from being optimized away
+    if (checksum < 0.0f) { std::cout << checksum << std::endl; }
+    return 0;
+}
+
+} //namespace mrtp
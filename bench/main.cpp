@@ -0,0 +1,144 @@
+/* File      : main.cpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "bench.hpp"
+
+
+namespace mrtp {
+
+static int open_counter(unsigned int type, unsigned long long config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+static long long read_counter(int fd) {
+    long long value = -1;
+    if ((fd < 0) || (read(fd, &value, sizeof(value)) != sizeof(value))) { return -1; }
+    return value;
+}
+
+CacheCounters::CacheCounters() : l1_(-1), llc_(-1) {
+    l1fd_ = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                         (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    llcfd_ = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+}
+
+CacheCounters::~CacheCounters() {
+    if (l1fd_ >= 0) { close(l1fd_); }
+    if (llcfd_ >= 0) { close(llcfd_); }
+}
+
+void CacheCounters::start() {
+    int fds[2] = {l1fd_, llcfd_};
+    for (int k = 0; k < 2; k++) {
+        if (fds[k] < 0) { continue; }
+        ioctl(fds[k], PERF_EVENT_IOC_RESET, 0);
+        ioctl(fds[k], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void CacheCounters::stop() {
+    if (l1fd_ >= 0) { ioctl(l1fd_, PERF_EVENT_IOC_DISABLE, 0); }
+    if (llcfd_ >= 0) { ioctl(llcfd_, PERF_EVENT_IOC_DISABLE, 0); }
+    l1_ = read_counter(l1fd_);
+    llc_ = read_counter(llcfd_);
+}
+
+long long CacheCounters::get_l1_misses() { return l1_; }
+
+long long CacheCounters::get_llc_misses() { return llc_; }
+
+double wall_seconds() {
+    std::chrono::duration<double> now = std::chrono::steady_clock::now().time_since_epoch();
+    return now.count();
+}
+
+/*
+xorshift64*, which gives the same numbers everywhere,
+unlike the distributions of <random>.
+*/
+float next_random(unsigned long long *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    unsigned long long value = *state * 0x2545f4914f6cdd1dULL;
+    return static_cast<float>(value >> 40) / static_cast<float>(1 << 24);
+}
+
+} //namespace mrtp
+
+
+void help_message() {
+    std::cout << R"(Usage: mrtp_bench BENCHMARK [OPTION]...
+  Benchmarks:
+    texture [PNG] [SIZE]     texture lookups along curved paths, in each format and layout,
+                             PNG (def. textures/02camino.png) repeated to SIZE texels (def. 2048)
+    kernels [-c FILE] [-s FILE]
+                             intersection of each primitive over rays that mostly hit or miss,
+                             and texture lookups, compared to a baseline FILE (-c) or saved as one (-s)
+    scene [SCENE OPTION]... FILE
+                             writes a generated scene to FILE, to be rendered with mrtp_cli
+    scaling [SCALING OPTION]... [SCENE OPTION]...
+                             renders generated scenes over every combination of the lists given,
+                             time per ray relative to the smallest scene shows how solve_hits scales
+
+  Scene options:
+    -s N                     spheres (def. 1000)
+    -c N                     cylinders (def. 250)
+    -p N                     planes, a floor and walls behind the actors (def. 1)
+    -r FRACTION              fraction of reflective actors (def. 0.2)
+    -x N                     textures used, 1 to 8 (def. 4)
+    -e SEED                  seed of the generator
+    -i DIR                   directory of the textures, as seen from where the scene is rendered
+                             (def. textures)
+
+  Scaling options:
+    -a LIST                  numbers of spheres and cylinders (def. 1000,10000,100000)
+    -y FRACTION              fraction of them that are cylinders (def. 0.2)
+    -w LIST                  resolutions as WIDTHxHEIGHT (def. 320x240)
+    -t LIST                  numbers of threads (def. 1)
+    -d LIST                  recursion depths (def. 3)
+    -o FILE                  CSV report, one row per rendering
+    -j FILE                  JSON report, with the ray statistics of each rendering
+
+Examples:
+  mrtp_bench texture textures/trak2_tile1b.png 4096
+  mrtp_bench kernels -c bench/kernels.baseline
+  mrtp_bench scene -s 5000 -c 1000 -r 0.5 -i ../textures examples/large.toml
+  mrtp_bench scaling -a 10000,100000,1000000 -w 320x240,640x480 -t 1,4 -o scaling.csv)" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        help_message();
+        return 1;
+    }
+
+    std::string benchmark(argv[1]);
+    if (benchmark == "texture") { return mrtp::bench_texture(argc - 2, argv + 2); }
+    if (benchmark == "kernels") { return mrtp::bench_kernels(argc - 2, argv + 2); }
+    if (benchmark == "scene") { return mrtp::bench_scene(argc - 2, argv + 2); }
+    if (benchmark == "scaling") { return mrtp::bench_scaling(argc - 2, argv + 2); }
+
+    std::cerr << "unknown benchmark: " << benchmark << std::endl;
+    return 1;
+}
@@ -0,0 +1,447 @@
+/* File      : scaling.cpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#include <Eigen/Core>
+#include <unistd.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "profile.hpp"
+#include "renderer.hpp"
+#include "world.hpp"
+
+
+namespace mrtp {
+
+static const unsigned long long kSeed = 0x9e3779b97f4a7c15ULL;
+
+// Room taken by each actor, the side of the cube of actors grows with their number
+static const float kSpacing = 3.0f;
+static const float kReflect = 0.5f;
+
+static const float kFOV = 93.0f;
+static const float kShadow = 0.25f;
+static const float kBias = 0.001f;
+
+static const char *kTextures[] = {"02camino.png",         "trak_light2b.png",
+                                  "trak2_tile1b.png",     "04univ2.png",
+                                  "04univ3.png",          "01tizeta_floor_f.png",
+                                  "01tizeta_floor_g.png", "qubodup-light_wood.png"};
+static const int kMaxTextures = 8;
+
+/*
+Parameters of a generated scene. The same parameters
+and seed always give the same scene. Textures are taken
+from the directory, as seen from where the scene is
+rendered.
+*/
+struct SceneSpec {
+    int spheres;
+    int cylinders;
+    int planes;
+    float reflective;
+    int textures;
+    unsigned long long seed;
+    const char *directory;
+};
+
+struct ScalingResult {
+    SceneSpec spec;
+    int width;
+    int height;
+    int threads;
+    int depth;
+    double build;
+    double render;
+    long long rays;
+    long long tests;
+    double growth;
+    std::string profile;
+};
+
+static float random_range(unsigned long long *state, float low, float high) {
+    return low + (high - low) * next_random(state);
+}
+
+static Eigen::Vector3f random_unit(unsigned long long *state) {
+    float z = 2.0f * next_random(state) - 1.0f;
+    float angle = 2.0f * static_cast<float>(M_PI) * next_random(state);
+    float r = std::sqrt(1.0f - z * z);
+    return Eigen::Vector3f(r * std::cos(angle), r * std::sin(angle), z);
+}
+
+/*
+Side of the cube around the origin that holds the
+spheres and cylinders of a scene.
+*/
+static float scene_side(const SceneSpec *spec) {
+    float nactors = static_cast<float>(std::max(spec->spheres + spec->cylinders, 1));
+    return kSpacing * std::cbrt(nactors);
+}
+
+static std::string texture_path(const SceneSpec *spec, int index) {
+    return std::string(spec->directory) + "/" + kTextures[index % spec->textures];
+}
+
+static void write_vector(std::ofstream *file, const char *id, Eigen::Vector3f vector) {
+    *file << id << " = [" << vector[0] << ", " << vector[1] << ", " << vector[2] << "]\n";
+}
+
+static void write_material(std::ofstream *file, const SceneSpec *spec, int index,
+                           unsigned long long *state) {
+    if (next_random(state) < spec->reflective) { *file << "reflect = " << kReflect << "\n"; }
+    *file << "texture = \"" << texture_path(spec, index) << "\"\n\n";
+}
+
+/*
+Writes a scene of randomly placed spheres and cylinders
+in a cube seen from outside, lit from above. The first
+plane is a floor under the cube, other planes are walls
+behind it, facing the camera.
+*/
+static bool generate_scene(const char *path, const SceneSpec *spec) {
+    std::ofstream file(path);
+    if (!file) { return false; }
+
+    unsigned long long state = spec->seed;
+    float side = scene_side(spec);
+    Eigen::Vector3f eye = side * Eigen::Vector3f(-0.9f, 0.9f, 0.7f);
+
+    file << std::fixed << std::setprecision(3);
+    file << "# Generated by mrtp_bench: " << spec->spheres << " spheres, " << spec->cylinders
+         << " cylinders, " << spec->planes << " planes\n\n";
+    file << "[camera]\n";
+    write_vector(&file, "center", eye);
+    file << "target = [0.0, 0.0, 0.0]\nroll = 0.0\n\n";
+    file << "[light]\n";
+    write_vector(&file, "center", side * Eigen::Vector3f(0.3f, -0.4f, 1.5f));
+    file << "\n";
+
+    for (int k = 0; k < spec->planes; k++) {
+        Eigen::Vector3f normal(0.0f, 0.0f, 1.0f);
+        while (k > 0) {
+            normal = random_unit(&state);
+            if (normal.dot(eye.normalized()) > 0.3f) { break; }
+        }
+        file << "[[planes]]\n";
+        write_vector(&file, "center", -side * normal);
+        write_vector(&file, "normal", normal);
+        file << "scale = 0.15\n";
+        write_material(&file, spec, k, &state);
+    }
+
+    for (int k = 0; k < spec->spheres; k++) {
+        Eigen::Vector3f center(random_range(&state, -0.5f, 0.5f),
+                               random_range(&state, -0.5f, 0.5f),
+                               random_range(&state, -0.5f, 0.5f));
+        file << "[[spheres]]\n";
+        write_vector(&file, "center", side * center);
+        write_vector(&file, "axis", random_unit(&state));
+        file << "radius = " << random_range(&state, 0.3f, 0.7f) << "\n";
+        write_material(&file, spec, k, &state);
+    }
+
+    for (int k = 0; k < spec->cylinders; k++) {
+        Eigen::Vector3f center(random_range(&state, -0.5f, 0.5f),
+                               random_range(&state, -0.5f, 0.5f),
+                               random_range(&state, -0.5f, 0.5f));
+        file << "[[cylinders]]\n";
+        write_vector(&file, "center", side * center);
+        write_vector(&file, "direction", random_unit(&state));
+        file << "radius = " << random_range(&state, 0.2f, 0.4f) << "\n";
+        file << "span = " << random_range(&state, 0.5f, 1.5f) << "\n";
+        write_material(&file, spec, k, &state);
+    }
+    return static_cast<bool>(file);
+}
+
+/*
+Reads an option of a scene, or returns false if the
+option is not one of them or its value is out of range.
+*/
+static bool read_scene_option(const std::string &option, const char *value, SceneSpec *spec) {
+    std::istringstream convert(value);
+    if (option == "-s") {
+        convert >> spec->spheres;
+        return (!convert.fail()) && (spec->spheres >= 0);
+    } else if (option == "-c") {
+        convert >> spec->cylinders;
+        return (!convert.fail()) && (spec->cylinders >= 0);
+    } else if (option == "-p") {
+        convert >> spec->planes;
+        return (!convert.fail()) && (spec->planes >= 0);
+    } else if (option == "-r") {
+        convert >> spec->reflective;
+        return (!convert.fail()) && (spec->reflective >= 0.0f) && (spec->reflective <= 1.0f);
+    } else if (option == "-x") {
+        convert >> spec->textures;
+        return (!convert.fail()) && (spec->textures >= 1) && (spec->textures <= kMaxTextures);
+    } else if (option == "-e") {
+        convert >> spec->seed;
+        return !convert.fail();
+    } else if (option == "-i") {
+        spec->directory = value;
+        return true;
+    }
+    return false;
+}
+
+/*
+Comma separated positive integers, or pairs of them
+joined by x for resolutions.
+*/
+static bool read_list(const char *text, bool pairs, std::vector<int> *values) {
+    std::istringstream items(text);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        std::istringstream convert(item);
+        int value = 0;
+        char separator = 0;
+        convert >> value;
+        if (convert.fail() || (value <= 0)) { return false; }
+        values->push_back(value);
+        if (pairs) {
+            convert >> separator >> value;
+            if (convert.fail() || (separator != 'x') || (value <= 0)) { return false; }
+            values->push_back(value);
+        }
+        if (!convert.eof()) { return false; }
+    }
+    return !values->empty();
+}
+
+static bool write_csv(const char *path, std::vector<ScalingResult> *results) {
+    std::ofstream file(path);
+    if (!file) { return false; }
+
+    file << "actors,spheres,cylinders,planes,width,height,threads,depth,build_seconds,"
+         << "render_seconds,rays,mrays_per_second,tests,tests_per_ray,ns_per_ray,growth"
+         << std::endl;
+    file << std::setprecision(6);
+
+    for (size_t k = 0; k < results->size(); k++) {
+        ScalingResult *result = &(*results)[k];
+        double rays = static_cast<double>(std::max(result->rays, 1LL));
+        file << result->spec.spheres + result->spec.cylinders << "," << result->spec.spheres
+             << "," << result->spec.cylinders << "," << result->spec.planes << ","
+             << result->width << "," << result->height << "," << result->threads << ","
+             << result->depth << "," << result->build << "," << result->render << ","
+             << result->rays << "," << 1.0e-6 * rays / result->render << "," << result->tests
+             << "," << result->tests / rays << "," << 1.0e9 * result->render / rays << ","
+             << result->growth << std::endl;
+    }
+    return static_cast<bool>(file);
+}
+
+static bool write_json(const char *path, std::vector<ScalingResult> *results) {
+    std::ofstream file(path);
+    if (!file) { return false; }
+
+    file << std::setprecision(6) << "[";
+
+    for (size_t k = 0; k < results->size(); k++) {
+        ScalingResult *result = &(*results)[k];
+        file << ((k > 0) ? ",\n " : "") << "{\"actors\": "
+             << result->spec.spheres + result->spec.cylinders << ", \"spheres\": "
+             << result->spec.spheres << ", \"cylinders\": " << result->spec.cylinders
+             << ", \"planes\": " << result->spec.planes << ", \"width\": " << result->width
+             << ", \"height\": " << result->height << ", \"threads\": " << result->threads
+             << ", \"depth\": " << result->depth << ", \"build\": " << result->build
+             << ", \"render\": " << result->render << ", \"growth\": " << result->growth
+             << ", \"profile\": " << result->profile << "}";
+    }
+    file << "]" << std::endl;
+    return static_cast<bool>(file);
+}
+
+/*
+Writes a generated scene, which can then be rendered
+with mrtp_cli like any other.
+*/
+int bench_scene(int argc, char **argv) {
+    SceneSpec spec = {1000, 250, 1, 0.2f, 4, kSeed, "textures"};
+    std::string path;
+
+    for (int i = 0; i < argc; i++) {
+        std::string option(argv[i]);
+        if ((i + 1 == argc) && (option[0] != '-')) {
+            path = option;
+        } else if ((i + 1 == argc) || !read_scene_option(option, argv[++i], &spec)) {
+            std::cerr << "unknown option or bad value: " << option << std::endl;
+            return 1;
+        }
+    }
+    if (path.empty()) {
+        std::cerr << "scene requires an output file" << std::endl;
+        return 1;
+    }
+    if (!generate_scene(path.c_str(), &spec)) {
+        std::cerr << "cannot write scene " << path << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Renders generated scenes over every combination of the
+numbers of actors, resolutions, threads and recursion
+depths given. Growth is the time per ray relative to the
+first number of actors at the same resolution, threads
+and depth, which stays near 1 while the hierarchy keeps
+solve_hits logarithmic. Results are rewritten to the
+report files after each rendering.
+*/
+int bench_scaling(int argc, char **argv) {
+    SceneSpec base = {0, 0, 1, 0.2f, 4, kSeed, "textures"};
+    float cylinders = 0.2f;
+    std::vector<int> actors, resolutions, threads, depths;
+    std::string csvpath, jsonpath;
+
+    for (int i = 0; i < argc; i++) {
+        std::string option(argv[i]);
+        if (i + 1 == argc) {
+            std::cerr << option << " requires a value" << std::endl;
+            return 1;
+        }
+        const char *value = argv[++i];
+        bool valid = true;
+
+        if (option == "-a") {
+            valid = read_list(value, false, &actors);
+        } else if (option == "-w") {
+            valid = read_list(value, true, &resolutions);
+        } else if (option == "-t") {
+            valid = read_list(value, false, &threads);
+        } else if (option == "-d") {
+            valid = read_list(value, false, &depths);
+        } else if (option == "-y") {
+            std::istringstream convert(value);
+            convert >> cylinders;
+            valid = (!convert.fail()) && (cylinders >= 0.0f) && (cylinders <= 1.0f);
+        } else if ((option == "-o") || (option == "-j")) {
+            ((option == "-o") ? csvpath : jsonpath) = value;
+        } else {
+            valid = read_scene_option(option, value, &base);
+        }
+        if (!valid) {
+            std::cerr << "unknown option or bad value: " << option << std::endl;
+            return 1;
+        }
+    }
+    if (actors.empty()) { actors = {1000, 10000, 100000}; }
+    if (resolutions.empty()) { resolutions = {320, 240}; }
+    if (threads.empty()) { threads = {1}; }
+    if (depths.empty()) { depths = {3}; }
+
+    // Scenes are rendered from here, so every texture has to be found from here too
+    for (int k = 0; k < base.textures; k++) {
+        std::string texture = texture_path(&base, k);
+        if (!std::ifstream(texture.c_str())) {
+            std::cerr << "cannot read texture " << texture << ", set their directory with -i"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    char path[] = "/tmp/mrtp_sceneXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        std::cerr << "cannot create scene file" << std::endl;
+        return 1;
+    }
+    close(fd);
+
+    std::vector<ScalingResult> results;
+    std::map<std::string, double> first;
+
+    std::cout << "   actors  resolution  threads  depth   build s  render s   Mrays/s"
+              << "  tests/ray    ns/ray  growth" << std::endl;
+
+    for (size_t a = 0; a < actors.size(); a++) {
+        SceneSpec spec = base;
+        spec.cylinders = static_cast<int>(std::lround(cylinders * actors[a]));
+        spec.spheres = actors[a] - spec.cylinders;
+
+        if (!generate_scene(path, &spec)) {
+            std::cerr << "cannot write scene " << path << std::endl;
+            unlink(path);
+            return 1;
+        }
+        World world(path);
+        double start = wall_seconds();
+        WorldStatus_t status = world.initialize();
+        double build = wall_seconds() - start;
+        if (status != ws_ok) {
+            std::cerr << "cannot load generated scene (status " << status << ")" << std::endl;
+            unlink(path);
+            return 1;
+        }
+        float distance = 4.0f * scene_side(&spec);
+
+        for (size_t r = 0; r < resolutions.size(); r += 2) {
+            for (size_t t = 0; t < threads.size(); t++) {
+                for (size_t d = 0; d < depths.size(); d++) {
+                    ScalingResult result = {spec, resolutions[r], resolutions[r + 1],
+                                            threads[t], depths[d], build, 0.0, 0, 0,
+                                            1.0, ""};
+                    Renderer renderer(&world, result.width, result.height, kFOV, distance,
+                                      kShadow, kBias, result.depth, result.threads,
+                                      "scaling.png");
+                    renderer.set_stats(true);
+                    result.render = renderer.render_scene();
+
+                    std::string name = std::to_string(actors[a]) + " actors";
+                    Profile profile(name.c_str());
+                    profile.set_phase(pp_parse, static_cast<float>(build));
+                    profile.set_phase(pp_render, static_cast<float>(result.render));
+                    renderer.get_profile(&profile);
+                    result.rays = profile.get_rays();
+                    result.tests = profile.get_tests();
+                    result.profile = profile.to_json();
+
+                    double rays = static_cast<double>(std::max(result.rays, 1LL));
+                    double perray = 1.0e9 * result.render / rays;
+                    std::string key = std::to_string(result.width) + "x" +
+                                      std::to_string(result.height) + " " +
+                                      std::to_string(result.threads) + " " +
+                                      std::to_string(result.depth);
+                    if (first.find(key) == first.end()) { first[key] = perray; }
+                    result.growth = perray / first[key];
+                    results.push_back(result);
+
+                    std::cout << std::setw(9) << actors[a] << std::setw(7) << result.width
+                              << "x" << std::left << std::setw(5) << result.height
+                              << std::right << std::setw(8) << result.threads << std::setw(7)
+                              << result.depth << std::fixed << std::setprecision(3)
+                              << std::setw(10) << build << std::setw(10) << result.render
+                              << std::setprecision(2) << std::setw(10)
+                              << 1.0e-6 * rays / result.render << std::setw(11)
+                              << result.tests / rays << std::setw(10) << perray
+                              << std::setw(8) << result.growth << std::endl;
+
+                    if (((!csvpath.empty()) && (!write_csv(csvpath.c_str(), &results))) ||
+                        ((!jsonpath.empty()) && (!write_json(jsonpath.c_str(), &results)))) {
+                        std::cerr << "cannot write report" << std::endl;
+                        unlink(path);
+                        return 1;
+                    }
+                }
+            }
+        }
+    }
+    unlink(path);
+    return 0;
+}
+
+} //namespace mrtp
@@ -0,0 +1,163 @@
+/* File      : texture.cpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#include <Eigen/Geometry>
+#include <cmath>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "png.hpp"
+#include "bench.hpp"
+#include "texture.hpp"
+
+
+namespace mrtp {
+
+static const int kScreenSize = 1024;
+static const int kTileSize = 32;
+static const int kRepeats = 8;
+static const int kDefaultTextureSize = 2048;
+
+static const char *kFormatNames[] = {"float", "rgb8", "rgba8", "bc1"};
+static const char *kLayoutNames[] = {"linear", "tiled", "morton"};
+
+/*
+Repeats a texture to size by size texels, so that it
+no longer fits in the caches.
+*/
+static bool write_texture(const char *input, const char *output, int size) {
+    try {
+        png::image<png::rgb_pixel> image(input);
+        png::image<png::rgb_pixel> large(size, size);
+        int width = image.get_width();
+        int height = image.get_height();
+
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) { large[y][x] = image[y % height][x % width]; }
+        }
+        large.write(output);
+    } catch (...) {
+        return false;
+    }
+    return true;
+}
+
+/*
+Texture coordinates of a sphere with a tilted axis,
+seen from the front and mapped as in Sphere. Pixels are
+listed tile by tile, as the renderer visits them. The
+sphere is about as wide in pixels as half the texture
+is in texels.
+*/
+static void sphere_coordinates(std::vector<float> *coords) {
+    Eigen::Vector3f ty(1.0f, 1.0f, 1.0f);
+    ty.normalize();
+    Eigen::Vector3f tx = ty.cross(Eigen::Vector3f(0.0f, 0.0f, 1.0f)).normalized();
+    Eigen::Vector3f tz = tx.cross(ty);
+
+    for (int tj = 0; tj < kScreenSize; tj += kTileSize) {
+        for (int ti = 0; ti < kScreenSize; ti += kTileSize) {
+            for (int j = tj; j < tj + kTileSize; j++) {
+                for (int i = ti; i < ti + kTileSize; i++) {
+                    float x = 2.0f * (i + 0.5f) / kScreenSize - 1.0f;
+                    float y = 2.0f * (j + 0.5f) / kScreenSize - 1.0f;
+                    float z2 = 1.0f - x * x - y * y;
+                    if (z2 <= 0.0f) { continue; }
+
+                    Eigen::Vector3f normal(x, y, std::sqrt(z2));
+                    float phi = std::acos(-normal.dot(ty));
+                    float theta = std::acos(normal.dot(tx) / std::sin(phi)) / (2.0f * M_PI);
+                    if (!std::isfinite(theta)) { continue; }
+
+                    coords->push_back((normal.dot(tz) > 0.0f) ? theta : (1.0f - theta));
+                    coords->push_back(phi / M_PI);
+                }
+            }
+        }
+    }
+}
+
+/*
+Times nearest lookups over the same path in every texel
+format and memory layout, and counts cache misses.
+*/
+int bench_texture(int argc, char **argv) {
+    std::string input = (argc > 0) ? argv[0] : "textures/02camino.png";
+    int size = kDefaultTextureSize;
+    if (argc > 1) {
+        std::stringstream convert(argv[1]);
+        convert >> size;
+        if (!convert || (size < 16)) {
+            std::cerr << "error reading texture size" << std::endl;
+            return 1;
+        }
+    }
+
+    std::stringstream name;
+    name << "/tmp/mrtp_bench_" << size << ".png";
+    std::string path = name.str();
+    if (!write_texture(input.c_str(), path.c_str(), size)) {
+        std::cerr << "cannot read texture " << input << std::endl;
+        return 1;
+    }
+
+    std::vector<float> coords;
+    sphere_coordinates(&coords);
+    long long lookups = static_cast<long long>(coords.size() / 2) * kRepeats;
+
+    std::cout << "texture " << input << " as " << size << "x" << size << ", "
+              << lookups << " lookups per run" << std::endl;
+    std::cout << "format  layout    MB     ns/lookup  L1 misses  LLC misses" << std::endl;
+
+    CacheCounters counters;
+    float checksum = 0.0f;
+
+    for (int format = tx_float; format <= tx_bc1; format++) {
+        for (int layout = tl_linear; layout <= tl_morton; layout++) {
+            Texture texture(path.c_str(), tf_nearest, static_cast<TexelFormat_t>(format),
+                            static_cast<TextureLayout_t>(layout), nullptr);
+            texture.load_texture();
+
+            double start = wall_seconds();
+            counters.start();
+            for (int r = 0; r < kRepeats; r++) {
+                for (size_t k = 0; k < coords.size(); k += 2) {
+                    checksum += texture.pick_pixel(coords[k], coords[k + 1], 1.0f)[0];
+                }
+            }
+            counters.stop();
+            double elapsed = wall_seconds() - start;
+
+            long long l1 = counters.get_l1_misses();
+            long long llc = counters.get_llc_misses();
+            std::cout << std::left << std::setw(8) << kFormatNames[format]
+                      << std::setw(8) << kLayoutNames[layout] << std::right << std::fixed
+                      << std::setprecision(1) << std::setw(6) << 1.0e-6 * texture.get_memory()
+                      << std::setprecision(2) << std::setw(12) << 1.0e9 * elapsed / lookups;
+            if (l1 >= 0) {
+                std::cout << std::setprecision(4) << std::setw(11) << double(l1) / lookups;
+            } else {
+                std::cout << std::setw(11) << "-";
+            }
+            if (llc >= 0) {
+                std::cout << std::setprecision(4) << std::setw(12) << double(llc) / lookups;
+            } else {
+                std::cout << std::setw(12) << "-";
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    std::remove(path.c_str());
+    // Keeps lookups from being optimized away
+    if (checksum < 0.0f) { std::cout << checksum << std::endl; }
+    return 0;
+}
+
+} //namespace mrtp
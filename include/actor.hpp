@@ -7,33 +7,70 @@
 #define _ACTOR_H
 
 #include <Eigen/Core>
+#include <cmath>
 
 #include "pixel.hpp"
 #include "texture.hpp"
 
 namespace mrtp {
 
+enum ActorType_t {at_plane, at_sphere, at_cylinder};
+
+
 class Actor {
   public:
     Actor();
     virtual ~Actor();
+    ActorType_t get_type();
     bool has_shadow();
     float get_reflect();
     virtual float solve(Eigen::Vector3f *origin, Eigen::Vector3f *direction,
                         float mind, float maxd) = 0;
-    virtual Pixel pick_pixel(Eigen::Vector3f *hit, Eigen::Vector3f *normal) = 0;
+    virtual Pixel pick_pixel(Eigen::Vector3f *hit, Eigen::Vector3f *normal,
+                             float footprint) = 0;
     virtual Eigen::Vector3f calculate_normal(Eigen::Vector3f *hit) = 0;
+    virtual bool calculate_bounds(Eigen::Vector3f *lower,
+                                  Eigen::Vector3f *upper) = 0;
+
+    static inline float solve_quadratic(float a, float b, float c, float mint,
+                                        float maxt);
 
   protected:
+    ActorType_t type_;
     bool has_shadow_;
     float reflect_;
     Texture *texture_;
 
-    static float solve_quadratic(float a, float b, float c, float mint,
-                                 float maxt);
     static Eigen::Vector3f generate_unit_vector(Eigen::Vector3f *vector);
 };
 
+/*
+Inlined, since it also serves the intersection
+kernels of compiled primitives.
+*/
+inline float Actor::solve_quadratic(float a, float b, float c, float mint,
+                                    float maxt) {
+    float t = -1.0f;
+    float delta = b * b - 4.0f * a * c;
+
+    if (delta >= 0.0f) {
+        if (delta > 0.0f) {
+            float sqdelta = std::sqrt(delta);
+            float tmp = 0.5f / a;
+            float ta = (-b - sqdelta) * tmp;
+            float tb = (-b + sqdelta) * tmp;
+            t = (ta < tb) ? ta : tb;
+        } else {
+            t = -b / (2.0f * a);
+        }
+
+        if ((t < mint) || (t > maxt)) {
+            t = -1.0f;
+        }
+    }
+    return t;
+}
+
 } //namespace mrtp
 
 #endif //_ACTOR_H
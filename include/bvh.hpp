@@ -0,0 +1,85 @@
+/* File      : bvh.hpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#ifndef _BVH_H
+#define _BVH_H
+
+#include <Eigen/Core>
+#include <unordered_map>
+#include <vector>
+
+#include "actor.hpp"
+#include "packet.hpp"
+#include "primitives.hpp"
+
+
+namespace mrtp {
+
+/*
+Inner nodes keep the index of their right child, the left
+child follows the parent. Leaves have right set to zero
+and refer to ranges of compiled spheres and cylinders.
+*/
+struct BvhNode {
+    Eigen::Vector3f lower;
+    Eigen::Vector3f upper;
+    int right;
+    int sphere_first;
+    int sphere_last;
+    int cylinder_first;
+    int cylinder_last;
+};
+
+/*
+Last actor that blocked a shadow ray, kept by each thread
+and tested first, since neighbouring pixels are mostly
+shadowed by the same actor. Valid only for the hierarchy
+with the same serial number.
+*/
+struct OccluderCache {
+    unsigned long serial;
+    ActorType_t type;
+    int index;
+};
+
+class Bvh {
+  public:
+    Bvh();
+    ~Bvh();
+    void build(std::vector<Actor *> *actors);
+    Actor *solve_hits(Eigen::Vector3f *origin, Eigen::Vector3f *direction,
+                      float *currd);
+    bool solve_shadows(Eigen::Vector3f *origin, Eigen::Vector3f *direction,
+                       float maxd, OccluderCache *cache);
+    void solve_hits_packet(RayPacket *packet);
+    void solve_shadows_packet(RayPacket *packet, OccluderCache *cache);
+
+  private:
+    unsigned long serial_;
+    std::vector<BvhNode> nodes_;
+    PlaneArray planes_;
+    SphereArray spheres_;
+    CylinderArray cylinders_;
+    int ninfinite_;
+    std::unordered_map<Actor *, int> slots_;
+
+    Actor *find_occluder(Eigen::Vector3f *origin, Eigen::Vector3f *direction,
+                         float maxd);
+    void find_occluders_packet(RayPacket *packet);
+    bool test_cached(OccluderCache *cache, Eigen::Vector3f *origin,
+                     Eigen::Vector3f *direction, float maxd);
+    void test_cached_packet(OccluderCache *cache, RayPacket *packet);
+    void update_cache(OccluderCache *cache, Actor *occluder);
+    void index_slots();
+    Actor *solve_leaf(BvhNode *node, Eigen::Vector3f *origin,
+                      Eigen::Vector3f *direction, float maxd, float *currd,
+                      Actor *hit);
+    static bool hit_box(BvhNode *node, Eigen::Vector3f *origin,
+                        Eigen::Vector3f *inverse, float maxd, float *entry);
+};
+
+} //namespace mrtp
+
+#endif //_BVH_H
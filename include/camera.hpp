@@ -17,7 +17,9 @@ class Camera {
     ~Camera();
     void calculate_window(int width, int height, float perspective);
     Eigen::Vector3f calculate_origin(int windowx, int windowy);
+    Eigen::Vector3f calculate_subpixel(float windowx, float windowy);
     Eigen::Vector3f calculate_direction(Eigen::Vector3f *origin);
+    Eigen::Vector3f get_eye();
 
   private:
     float roll_;
@@ -15,12 +15,18 @@ namespace mrtp {
 class Cylinder : public Actor {
   public:
     Cylinder(Eigen::Vector3f *center, Eigen::Vector3f *direction, float radius, 
-             float span, float reflect, const char *texture);
+             float span, float reflect, const char *texture, TexelFormat_t format);
     ~Cylinder();
     float solve(Eigen::Vector3f *origin, Eigen::Vector3f *direction, float mind,
                 float maxd);
-    Pixel pick_pixel(Eigen::Vector3f *hit, Eigen::Vector3f *normal);
+    Eigen::Vector3f get_center();
+    Eigen::Vector3f get_direction();
+    float get_radius();
+    float get_span();
+    Pixel pick_pixel(Eigen::Vector3f *hit, Eigen::Vector3f *normal,
+                      float footprint);
     Eigen::Vector3f calculate_normal(Eigen::Vector3f *hit);
+    bool calculate_bounds(Eigen::Vector3f *lower, Eigen::Vector3f *upper);
 
   private:
     Eigen::Vector3f A_;
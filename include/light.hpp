@@ -13,12 +13,15 @@ namespace mrtp {
 
 class Light {
   public:
-    Light(Eigen::Vector3f *center);
+    Light(Eigen::Vector3f *center, float power);
     ~Light();
     Eigen::Vector3f calculate_ray(Eigen::Vector3f *hit);
+    Eigen::Vector3f get_center();
+    float get_power();
 
   private:
     Eigen::Vector3f center_;
+    float power_;
 };
 
 } //namespace mrtp
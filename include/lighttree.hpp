@@ -0,0 +1,66 @@
+/* File      : lighttree.hpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#ifndef _LIGHTTREE_H
+#define _LIGHTTREE_H
+
+#include <Eigen/Core>
+#include <vector>
+
+#include "light.hpp"
+
+
+namespace mrtp {
+
+static const int kMaxLightSamples = 16;
+
+/*
+Inner nodes keep the index of their right child, the left
+child follows the parent. Leaves have right set to zero
+and refer to a single light. Lights below a node lie in
+a sphere of radius around center, power is their sum.
+*/
+struct LightNode {
+    LightNode();
+
+    Eigen::Vector3f center;
+    float radius;
+    float power;
+    int right;
+    int light;
+};
+
+/*
+A light picked for shading, with the weight of its
+contribution: 1 for lights shaded exactly, the inverse
+of the probability of the pick for sampled ones.
+*/
+struct LightSample {
+    Light *light;
+    float weight;
+};
+
+class LightTree {
+  public:
+    LightTree();
+    ~LightTree();
+    void build(std::vector<Light *> *lights);
+    int select(Eigen::Vector3f *point, Eigen::Vector3f *normal, float maxd,
+               int count, LightSample *samples);
+
+  private:
+    std::vector<LightNode> nodes_;
+    std::vector<Light *> lights_;
+
+    int build_node(std::vector<int> *order, int first, int last);
+    float importance(LightNode *node, Eigen::Vector3f *point,
+                     Eigen::Vector3f *normal, float maxd);
+    bool sample_node(int index, Eigen::Vector3f *point, Eigen::Vector3f *normal,
+                     float maxd, unsigned int *state, LightSample *sample);
+};
+
+} //namespace mrtp
+
+#endif //_LIGHTTREE_H
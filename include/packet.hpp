@@ -0,0 +1,57 @@
+/* File      : packet.hpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#ifndef _PACKET_H
+#define _PACKET_H
+
+
+namespace mrtp {
+
+class Actor;
+struct PlaneArray;
+struct SphereArray;
+struct CylinderArray;
+
+static const int kMaxPacketSize = 16;
+
+/*
+A bundle of coherent rays traced together. Components
+are stored in separate arrays so that lane loops map
+onto SIMD registers. Only the first size lanes are used
+and only active lanes are updated by the kernels.
+*/
+struct alignas(64) RayPacket {
+    int size;
+    int active[kMaxPacketSize];
+    float ox[kMaxPacketSize];
+    float oy[kMaxPacketSize];
+    float oz[kMaxPacketSize];
+    float dx[kMaxPacketSize];
+    float dy[kMaxPacketSize];
+    float dz[kMaxPacketSize];
+    float ix[kMaxPacketSize];
+    float iy[kMaxPacketSize];
+    float iz[kMaxPacketSize];
+    float maxd[kMaxPacketSize];
+    float currd[kMaxPacketSize];
+    Actor *hit[kMaxPacketSize];
+};
+
+int detect_packet_size();
+void packet_shape(int size, int *width, int *height);
+void packet_prepare(RayPacket *packet);
+
+bool packet_hit_box(RayPacket *packet, const float *lower, const float *upper,
+                    float *entry);
+void packet_solve_planes(RayPacket *packet, PlaneArray *planes, int first,
+                         int last, bool occluders);
+void packet_solve_spheres(RayPacket *packet, SphereArray *spheres, int first,
+                          int last, bool occluders);
+void packet_solve_cylinders(RayPacket *packet, CylinderArray *cylinders,
+                            int first, int last, bool occluders);
+
+} //namespace mrtp
+
+#endif //_PACKET_H
@@ -16,12 +16,16 @@ namespace mrtp {
 class Plane : public Actor {
   public:
     Plane(Eigen::Vector3f *center, Eigen::Vector3f *normal, float scale, 
-          float reflect, const char *texture);
+          float reflect, const char *texture, TexelFormat_t format);
     ~Plane();
     float solve(Eigen::Vector3f *origin, Eigen::Vector3f *direction, float mind,
                 float maxd);
-    Pixel pick_pixel(Eigen::Vector3f *hit, Eigen::Vector3f *normal);
+    Eigen::Vector3f get_center();
+    Eigen::Vector3f get_normal();
+    Pixel pick_pixel(Eigen::Vector3f *hit, Eigen::Vector3f *normal,
+                      float footprint);
     Eigen::Vector3f calculate_normal(Eigen::Vector3f *hit);
+    bool calculate_bounds(Eigen::Vector3f *lower, Eigen::Vector3f *upper);
 
   private:
     Eigen::Vector3f center_;
@@ -0,0 +1,60 @@
+/* File      : pngstream.hpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#ifndef _PNGSTREAM_H
+#define _PNGSTREAM_H
+
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#include "pixel.hpp"
+
+
+namespace mrtp {
+
+/*
+A PNG file written while rendering. Rows are split into
+bands, each quantized, filtered and deflated on its own
+by the thread that finishes it. Bands are written in
+order as they become ready, their deflate streams joined
+into the single zlib stream of the image.
+*/
+class PngStream {
+  public:
+    PngStream();
+    ~PngStream();
+    bool open(const char *path, int width, int height, int bandrows);
+    void encode_band(int band, const Pixel *pixels);
+    bool finish(const Pixel *framebuffer);
+    int get_bands();
+    int get_streamed();
+
+  private:
+    FILE *file_;
+    int width_;
+    int height_;
+    int bandrows_;
+    int nbands_;
+    int nextband_;
+    int nstreamed_;
+    bool failed_;
+    unsigned long adler_;
+    std::mutex mutex_;
+    std::vector<std::vector<unsigned char> > deflated_;
+    std::vector<unsigned long> adlers_;
+    std::vector<unsigned long> lengths_;
+    std::vector<unsigned char> encoded_;
+
+    void filter_rows(const Pixel *pixels, int nrows, std::vector<unsigned char> *raw);
+    bool deflate_rows(std::vector<unsigned char> *raw, bool last,
+                      std::vector<unsigned char> *out);
+    void write_ready();
+    void write_chunk(const char *type, const unsigned char *data, size_t size);
+};
+
+} //namespace mrtp
+
+#endif //_PNGSTREAM_H
@@ -0,0 +1,83 @@
+/* File      : primitives.hpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#ifndef _PRIMITIVES_H
+#define _PRIMITIVES_H
+
+#include <Eigen/Core>
+#include <vector>
+
+#include "actor.hpp"
+#include "cylinder.hpp"
+#include "plane.hpp"
+#include "sphere.hpp"
+
+
+namespace mrtp {
+
+/*
+Compiled actors. Each primitive type is stored as a
+structure of arrays, so that intersection kernels walk
+contiguous memory instead of calling Actor::solve.
+The original actors are kept for shading.
+*/
+struct PlaneArray {
+    std::vector<float> cx, cy, cz;
+    std::vector<float> nx, ny, nz;
+    std::vector<float> reflect;
+    std::vector<int> shadow;
+    std::vector<Actor *> actors;
+
+    void clear();
+    void add(Plane *plane);
+};
+
+struct SphereArray {
+    std::vector<float> cx, cy, cz;
+    std::vector<float> radius;
+    std::vector<float> reflect;
+    std::vector<int> shadow;
+    std::vector<Actor *> actors;
+
+    void clear();
+    void add(Sphere *sphere);
+};
+
+struct CylinderArray {
+    std::vector<float> cx, cy, cz;
+    std::vector<float> ax, ay, az;
+    std::vector<float> radius;
+    std::vector<float> span;
+    std::vector<float> reflect;
+    std::vector<int> shadow;
+    std::vector<Actor *> actors;
+
+    void clear();
+    void add(Cylinder *cylinder);
+};
+
+int solve_planes(PlaneArray *planes, int first, int last,
+                 Eigen::Vector3f *origin, Eigen::Vector3f *direction,
+                 float maxd, float *currd);
+int solve_spheres(SphereArray *spheres, int first, int last,
+                  Eigen::Vector3f *origin, Eigen::Vector3f *direction,
+                  float maxd, float *currd);
+int solve_cylinders(CylinderArray *cylinders, int first, int last,
+                    Eigen::Vector3f *origin, Eigen::Vector3f *direction,
+                    float maxd, float *currd);
+
+int occlude_planes(PlaneArray *planes, int first, int last,
+                   Eigen::Vector3f *origin, Eigen::Vector3f *direction,
+                   float maxd);
+int occlude_spheres(SphereArray *spheres, int first, int last,
+                    Eigen::Vector3f *origin, Eigen::Vector3f *direction,
+                    float maxd);
+int occlude_cylinders(CylinderArray *cylinders, int first, int last,
+                      Eigen::Vector3f *origin, Eigen::Vector3f *direction,
+                      float maxd);
+
+} //namespace mrtp
+
+#endif //_PRIMITIVES_H
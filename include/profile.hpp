@@ -0,0 +1,79 @@
+/* File      : profile.hpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include <string>
+#include <vector>
+
+
+namespace mrtp {
+
+enum ProfilePhase_t {pp_parse, pp_textures, pp_render, pp_write};
+
+static const int kProfilePhases = 4;
+
+// Rays counted per level of recursion, deeper ones go to the last
+static const int kProfileDepths = 16;
+
+/*
+Counts kept by each rendering thread while statistics
+are on. Tests are ray-primitive intersection tests, each
+lane of a packet counting as one, hits are rays that hit
+an actor. Busy is the time spent on tiles.
+*/
+struct RayCounters {
+    bool enabled;
+    long long primary;
+    long long reflected;
+    long long shadow;
+    long long tests;
+    long long hits;
+    long long shadownanos;
+    long long busynanos;
+    long long depths[kProfileDepths];
+};
+
+void clear_counters(RayCounters *counters);
+void add_counters(RayCounters *total, const RayCounters *counters);
+
+/*
+Counters of the calling thread.
+*/
+extern thread_local RayCounters rayCounters;
+
+inline void count_tests(long long ntests) {
+    if (rayCounters.enabled) { rayCounters.tests += ntests; }
+}
+
+/*
+Wall time of the phases of rendering a scene and the
+ray counts of each rendering thread, printed or written
+as JSON.
+*/
+class Profile {
+  public:
+    Profile(const char *scene);
+    void set_phase(ProfilePhase_t phase, float seconds);
+    void add_thread(const RayCounters *counters);
+    long long get_rays();
+    long long get_tests();
+    float get_rate();
+    void print();
+    std::string to_json();
+
+  private:
+    std::string scene_;
+    float phases_[kProfilePhases];
+    std::vector<RayCounters> threads_;
+    RayCounters total_;
+};
+
+bool write_profiles(const char *path, std::vector<Profile> *profiles);
+
+} //namespace mrtp
+
+#endif //_PROFILE_H
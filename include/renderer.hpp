@@ -7,12 +7,24 @@
 #define _RENDERER_H
 
 #include <Eigen/Core>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "actor.hpp"
 #include "camera.hpp"
 #include "light.hpp"
+#include "packet.hpp"
 #include "pixel.hpp"
+#include "pngstream.hpp"
+#include "profile.hpp"
+#include "shadowmap.hpp"
+#include "threadpool.hpp"
+#include "tiles.hpp"
+#include "wavefront.hpp"
 #include "world.hpp"
 
 
@@ -20,6 +32,24 @@ namespace mrtp {
 
 enum RendererStatus_t {rs_ok, rs_fail};
 
+enum ParallelBackend_t {pb_openmp, pb_pool};
+
+enum RenderPass_t {rp_shadow_map, rp_coarse, rp_primary, rp_detect, rp_refine};
+
+enum OutputFormat_t {of_png, of_ppm, of_pfm, of_raw};
+
+enum HeatMetric_t {hm_none, hm_time, hm_tests};
+
+/*
+OpenMP is used when compiled in, unless the built-in
+thread pool is requested with -DMRTP_THREAD_POOL.
+*/
+#if defined(_OPENMP) && !defined(MRTP_THREAD_POOL)
+static const ParallelBackend_t kDefaultBackend = pb_openmp;
+#else
+static const ParallelBackend_t kDefaultBackend = pb_pool;
+#endif
+
 
 class Renderer {
   public:
@@ -29,15 +59,86 @@ class Renderer {
     ~Renderer();
     float render_scene();
     bool write_scene();
+    void set_packet_size(int size);
+    void set_tiles(int size, TileOrder_t order);
+    void set_backend(ParallelBackend_t backend);
+    void set_antialias(int minsamples, int maxsamples, float threshold);
+    void set_progressive(int stride);
+    void set_preview(const char *path, float interval);
+    void set_time_budget(float seconds);
+    bool budget_expired();
+    void set_stats(bool stats);
+    void set_wavefront(bool wavefront, RaySort_t sort);
+    void set_shadow_map(int resolution, float bias);
+    void set_light_samples(int count);
+    void set_streaming(bool streaming);
+    void set_output_format(OutputFormat_t format);
+    void set_out_of_core(bool outofcore);
+    void set_heatmap(HeatMetric_t metric);
+    bool write_heatmap(const char *pngpath, const char *csvpath);
+    int get_streamed_bands();
+    long long get_shadow_rays();
+    float get_shadow_time();
+    void get_profile(Profile *profile);
 
   private:
     World *world_;
     const char *path_;
-    std::vector<Pixel> framebuffer_;
+    Pixel *framebuffer_;
+    size_t fbbytes_;
     int width_;
     int height_;
     int maxdepth_;
     int nthreads_;
+    int packetsize_;
+    int tilesize_;
+    TileOrder_t tileorder_;
+    ParallelBackend_t backend_;
+    RenderPass_t pass_;
+    int minsamples_;
+    int maxsamples_;
+    float threshold_;
+    std::vector<Actor *> hitbuffer_;
+    std::vector<unsigned char> refine_;
+    int stride_;
+    int passstride_;
+    std::string previewpath_;
+    float previewinterval_;
+    float budget_;
+    std::chrono::steady_clock::time_point timestart_;
+    std::chrono::steady_clock::time_point lastpreview_;
+    int npreviews_;
+    std::atomic<bool> expired_;
+    bool stats_;
+    bool wavefront_;
+    RaySort_t raysort_;
+    int mapsize_;
+    float mapbias_;
+    ShadowMap shadowmap_;
+    bool usemap_;
+    int lightsamples_;
+    bool manylights_;
+    bool filtering_;
+    float spread_;
+    std::vector<RayCounters> counters_;
+    std::vector<std::thread::id> counterids_;
+    std::mutex countermutex_;
+    HeatMetric_t heatmap_;
+    std::vector<TileCost> tilecosts_;
+    std::vector<Tile> tiles_;
+    int tilecols_;
+    long long ntiles_;
+    std::atomic<long long> nexttile_;
+    bool streaming_;
+    bool outofcore_;
+    bool banded_;
+    OutputFormat_t format_;
+    int output_;
+    size_t headersize_;
+    std::atomic<bool> outputfailed_;
+    RenderPass_t lastpass_;
+    PngStream stream_;
+    std::vector<std::atomic<int> > bandtiles_;
     float maxdist_;
     float shadow_;
     float bias_;
@@ -47,11 +148,68 @@ class Renderer {
 
     bool solve_shadows(Eigen::Vector3f *origin, Eigen::Vector3f *direction,
                        float maxdist);
+    void solve_shadows_packet(RayPacket *packet);
     Actor *solve_hits(Eigen::Vector3f *origin, Eigen::Vector3f *direction,
                       float *currd);
+    void count_ray(int depth, bool hit);
+    float calculate_footprint(Eigen::Vector3f *origin, Eigen::Vector3f *direction,
+                              float currd, Eigen::Vector3f *normal);
+    Pixel shade_local(Actor *hitactor, Eigen::Vector3f *inter,
+                      Eigen::Vector3f *normal, float lightd, float intensity,
+                      bool isshadow, float footprint);
+    Pixel shade_lights(Actor *hitactor, Eigen::Vector3f *inter,
+                       Eigen::Vector3f *normal, Eigen::Vector3f *corr,
+                       float footprint, bool *lit);
+    Pixel shade_many(Actor *hitactor, Eigen::Vector3f *origin,
+                     Eigen::Vector3f *direction, float currd, int depth);
+    Pixel reflect_hit(Actor *hitactor, Eigen::Vector3f *direction,
+                      Eigen::Vector3f *corr, Eigen::Vector3f *normal,
+                      Pixel local, int depth);
+    Pixel shade_hit(Actor *hitactor, Eigen::Vector3f *direction,
+                    Eigen::Vector3f *inter, Eigen::Vector3f *corr,
+                    Eigen::Vector3f *normal, float lightd, float intensity,
+                    bool isshadow, float footprint, int depth);
     Pixel trace_ray_r(Eigen::Vector3f *origin, Eigen::Vector3f *direction,
-                      int depth);
-    void render_block(int block, int nlines);
+                      int depth, Actor **primary);
+    Eigen::Vector3f calculate_sample(int pixel, int k, int n,
+                                     Eigen::Vector3f *direction);
+    void trace_samples(const int *pixels, int count, int nsamples,
+                       Pixel *colors, float *spread);
+    void trace_packet(int x, int y, int xend, int yend);
+    void shade_packet(RayPacket *packet, Pixel *pixels);
+    void render_tile(Tile *tile);
+    void render_tile_wavefront(Tile *tile);
+    void wave_intersect(std::vector<WaveRay> *rays);
+    void wave_prepare(std::vector<WaveRay> *rays, std::vector<int> *lit);
+    void wave_shadows(std::vector<WaveRay> *rays, std::vector<int> *lit);
+    void wave_shade(std::vector<WaveRay> *rays, std::vector<WaveStep> *steps,
+                    std::vector<int> *ends, std::vector<WaveRay> *next);
+    void wave_sort(std::vector<WaveRay> *rays, std::vector<WaveRay> *scratch);
+    void coarse_tile(Tile *tile);
+    void detect_tile(Tile *tile);
+    bool needs_refine(int i, int j);
+    void refine_tile(Tile *tile);
+    void refine_pixels(const int *pixels, int count, bool flagged);
+    int batch_size(int nsamples);
+    void allocate_framebuffer();
+    void release_pixels(size_t first, size_t count);
+    Tile tile_at(long long index);
+    void render_tiles();
+    void merge_counters();
+    void record_cost(Tile *tile, std::chrono::steady_clock::time_point start,
+                     const RayCounters *before);
+    void finish_tile(Tile *tile);
+    void flush_band(int band);
+    int run_pass(RenderPass_t pass);
+    float elapsed(std::chrono::steady_clock::time_point since);
+    void write_preview(bool last);
+    bool write_png(const char *path);
+    bool write_ppm(const char *path);
+    bool write_pfm(const char *path);
+    bool write_raw(const char *path);
+    bool open_output();
+    void write_band(int band);
+    bool close_output();
 };
 
 } //namespace mrtp
@@ -0,0 +1,48 @@
+/* File      : shadowmap.hpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#ifndef _SHADOWMAP_H
+#define _SHADOWMAP_H
+
+#include <Eigen/Core>
+#include <vector>
+
+#include "actor.hpp"
+#include "bvh.hpp"
+#include "packet.hpp"
+
+
+namespace mrtp {
+
+/*
+Cube map around a point light. Each of the six faces
+holds, per texel, the distance from the light to the
+closest shadow casting actor and the actor itself.
+Faces are +x, -x, +y, -y, +z, -z, stored one after
+another, row by row.
+*/
+class ShadowMap {
+  public:
+    ShadowMap();
+    ~ShadowMap();
+    void setup(Eigen::Vector3f *center, int resolution, float maxd);
+    int get_rows();
+    void build_rows(Bvh *occluders, int first, int last, int packetsize);
+    Actor *lookup(Eigen::Vector3f *point, float bias);
+
+  private:
+    Eigen::Vector3f center_;
+    int resolution_;
+    float maxd_;
+    std::vector<float> depth_;
+    std::vector<Actor *> occluder_;
+
+    Eigen::Vector3f texel_direction(int face, int x, int y);
+    void build_packet(Bvh *occluders, int row, int x, int packetsize);
+};
+
+} //namespace mrtp
+
+#endif //_SHADOWMAP_H
@@ -16,12 +16,16 @@ namespace mrtp {
 class Sphere : public Actor {
   public:
     Sphere(Eigen::Vector3f *center, float radius, Eigen::Vector3f *axis, 
-           float reflect, const char *texture);
+           float reflect, const char *texture, TexelFormat_t format);
     ~Sphere();
     float solve(Eigen::Vector3f *origin, Eigen::Vector3f *direction, float mind,
                 float maxd);
-    Pixel pick_pixel(Eigen::Vector3f *hit, Eigen::Vector3f *normal);
+    Eigen::Vector3f get_center();
+    float get_radius();
+    Pixel pick_pixel(Eigen::Vector3f *hit, Eigen::Vector3f *normal,
+                      float footprint);
     Eigen::Vector3f calculate_normal(Eigen::Vector3f *hit);
+    bool calculate_bounds(Eigen::Vector3f *lower, Eigen::Vector3f *upper);
 
   private:
     Eigen::Vector3f center_;
@@ -6,34 +6,146 @@
 #ifndef _TEXTURE_H
 #define _TEXTURE_H
 
+#include <atomic>
 #include <list>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 #include "pixel.hpp"
 
 namespace mrtp {
 
+enum TextureFilter_t {tf_nearest, tf_bilinear, tf_trilinear};
+enum TexelFormat_t {tx_float, tx_rgb8, tx_rgba8, tx_bc1};
+enum TextureLayout_t {tl_linear, tl_tiled, tl_morton};
+
+bool parse_texel_format(const char *name, TexelFormat_t *format);
+bool parse_texture_layout(const char *name, TextureLayout_t *layout);
+
+/*
+Texels of a loaded texture with all levels of its
+pyramid, in the format and layout of the texture. They
+are kept in data for floats, in bytes for the compact
+formats, or in a mapped cache file.
+*/
+struct TexelStore {
+    int width;
+    int height;
+    std::vector<Pixel> data;
+    std::vector<unsigned char> bytes;
+    std::vector<int> offsets;
+    std::vector<int> widths;
+    std::vector<int> heights;
+    std::vector<int> strides;
+    std::vector<int> spans;
+    const unsigned char *texels;
+    void *mapping;
+    size_t mapsize;
+
+    TexelStore();
+    TexelStore(const TexelStore &) = delete;
+    TexelStore &operator=(const TexelStore &) = delete;
+    ~TexelStore();
+    size_t get_memory();
+};
+
 class Texture {
   public:
-    Texture(const char *path);
+    Texture(const char *path, TextureFilter_t filter, TexelFormat_t format,
+            TextureLayout_t layout, const char *cache);
+    Texture(const Texture &) = delete;
+    Texture &operator=(const Texture &) = delete;
     ~Texture();
     void load_texture();
-    bool check_path(const char *path);
+    bool is_loaded();
+    size_t get_memory();
+    float get_load_time();
+    unsigned long get_last_use();
+    TexelStore *evict();
     Pixel pick_pixel(float fracx, float fracy, float scale);
+    Pixel filter_pixel(float fracx, float fracy, float scale, float footx,
+                       float footy);
 
   private:
-    int width_;
-    int height_;
-    std::vector<Pixel> data_;
+    TextureFilter_t filter_;
+    TexelFormat_t format_;
+    TextureLayout_t layout_;
     std::string spath_;
+    std::string cache_;
+    std::atomic<TexelStore *> store_;
+    std::atomic<unsigned long> lastuse_;
+    std::mutex loading_;
+    float loadtime_;
+
+    TexelStore *acquire_store();
+    TexelStore *load_lazily();
+    TexelStore *load_store();
+    TexelStore *decode();
+    void build_mipmaps(TexelStore *store);
+    void arrange(TexelStore *store);
+    void compress_block(TexelStore *store, int level, int bx, int by, unsigned char *block);
+    int texel_index(TexelStore *store, int level, int x, int y);
+    Pixel fetch(TexelStore *store, int level, int x, int y);
+    Pixel sample_level(TexelStore *store, int level, float fracx, float fracy, float scale);
+    std::string cache_file();
+    bool map_cache(const std::string &file, TexelStore *store);
+    void write_cache(const std::string &file, TexelStore *store);
 };
 
 class TextureCollector {
   public:
-    Texture *add(const char *path);
+    TextureCollector();
+    ~TextureCollector();
+    Texture *add(const char *path, TexelFormat_t format);
+    void set_filter(TextureFilter_t filter);
+    TextureFilter_t get_filter();
+    void set_format(TexelFormat_t format);
+    TexelFormat_t get_format();
+    void set_layout(TextureLayout_t layout);
+    void set_cache(const char *directory);
+    void set_lazy(bool lazy);
+    void set_threads(int nthreads);
+    void set_budget(size_t bytes);
+    void load_pending();
+    void admit(Texture *texture, size_t bytes);
+    void enter_reading();
+    void leave_reading();
+    int get_count();
+    int get_loaded();
+    size_t get_memory();
+    float get_load_time();
+    bool has_budget();
+    long long get_hits();
+    long long get_misses();
+    long long get_evictions();
+    size_t get_peak();
 
   private:
+    TextureFilter_t filter_;
+    TexelFormat_t format_;
+    TextureLayout_t layout_;
+    float loadtime_;
+    std::string cache_;
+    bool lazy_;
+    int nthreads_;
     std::list<Texture> textures_;
+    std::unordered_map<std::string, Texture *> index_;
+    std::vector<Texture *> pending_;
+
+    size_t budget_;
+    size_t resident_;
+    size_t peak_;
+    long long misses_;
+    long long evictions_;
+    std::mutex residency_;
+    std::vector<Texture *> residents_;
+    std::vector<std::pair<TexelStore *, unsigned long> > retired_;
+
+    unsigned long oldest_reading();
+    void trim(Texture *keep);
+    void reclaim();
 };
 
 
@@ -0,0 +1,51 @@
+/* File      : threadpool.hpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#ifndef _THREADPOOL_H
+#define _THREADPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace mrtp {
+
+enum PinMode_t {pm_none, pm_compact, pm_scatter};
+
+
+class ThreadPool {
+  public:
+    ThreadPool();
+    ~ThreadPool();
+    void start(int nthreads, PinMode_t pin);
+    void stop();
+    int get_size();
+    PinMode_t get_pin();
+    void run(std::function<void()> task);
+
+  private:
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    std::function<void()> task_;
+    unsigned long generation_;
+    int pending_;
+    bool stopping_;
+    PinMode_t pin_;
+
+    void work(unsigned long seen);
+    void pin_worker(int index, int nthreads);
+};
+
+
+extern ThreadPool threadPool;
+
+} //namespace mrtp
+
+#endif //_THREADPOOL_H
@@ -0,0 +1,41 @@
+/* File      : tiles.hpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#ifndef _TILES_H
+#define _TILES_H
+
+#include <vector>
+
+
+namespace mrtp {
+
+enum TileOrder_t {to_scanline, to_hilbert, to_spiral};
+
+/*
+A rectangle of pixels [x, xend) x [y, yend).
+*/
+struct Tile {
+    int x;
+    int y;
+    int xend;
+    int yend;
+};
+
+/*
+Cost of rendering a tile, summed over its passes: wall
+time, intersection tests and rays traced.
+*/
+struct TileCost {
+    long long nanos;
+    long long tests;
+    long long rays;
+};
+
+void generate_tiles(int width, int height, int size, TileOrder_t order,
+                    std::vector<Tile> *tiles);
+
+} //namespace mrtp
+
+#endif //_TILES_H
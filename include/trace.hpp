@@ -0,0 +1,109 @@
+/* File      : trace.hpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#ifndef _TRACE_H
+#define _TRACE_H
+
+/*
+Timeline of what each thread does, written as Chrome
+trace JSON for chrome://tracing or Perfetto. Compiled in
+with -DMRTP_TRACE, the macros expand to nothing otherwise.
+
+Names and texts given to the macros must outlive the
+tracer, e.g. string literals or names of loaded files.
+*/
+#ifdef MRTP_TRACE
+
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <vector>
+
+
+namespace mrtp {
+
+// Events kept per thread, older ones are overwritten
+static const int kTraceEvents = 1 << 16;
+
+struct TraceEvent {
+    const char *name;
+    const char *text;
+    long long arg;
+    long long start;
+    long long duration;
+};
+
+/*
+Ring of the last events of one thread, written by that
+thread only.
+*/
+struct TraceBuffer {
+    int tid;
+    long long count;
+    std::vector<TraceEvent> events;
+};
+
+class Tracer {
+  public:
+    Tracer();
+    void start();
+    bool is_enabled() { return enabled_; }
+    long long now();
+    void record(const char *name, const char *text, long long arg, long long start);
+    bool write(const char *path);
+
+  private:
+    bool enabled_;
+    std::chrono::steady_clock::time_point origin_;
+    std::mutex mutex_;
+    std::list<TraceBuffer> buffers_;
+
+    TraceBuffer *add_buffer();
+};
+
+
+extern Tracer tracer;
+
+/*
+Records an event from its construction to the end of
+the enclosing scope, if tracing was started.
+*/
+class TraceScope {
+  public:
+    TraceScope(const char *name, const char *text, long long arg) :
+        name_(name), text_(text), arg_(arg), start_(0) {
+        if (tracer.is_enabled()) { start_ = tracer.now(); }
+    }
+    ~TraceScope() {
+        if (tracer.is_enabled()) { tracer.record(name_, text_, arg_, start_); }
+    }
+
+  private:
+    const char *name_;
+    const char *text_;
+    long long arg_;
+    long long start_;
+};
+
+} //namespace mrtp
+
+#define MRTP_TRACE_JOIN(a, b) a##b
+#define MRTP_TRACE_VARIABLE(line) MRTP_TRACE_JOIN(traceScope, line)
+#define MRTP_TRACE_SCOPE(name) \
+    mrtp::TraceScope MRTP_TRACE_VARIABLE(__LINE__)(name, nullptr, -1)
+#define MRTP_TRACE_SCOPE_ARG(name, arg) \
+    mrtp::TraceScope MRTP_TRACE_VARIABLE(__LINE__)(name, nullptr, arg)
+#define MRTP_TRACE_SCOPE_TEXT(name, text) \
+    mrtp::TraceScope MRTP_TRACE_VARIABLE(__LINE__)(name, text, -1)
+
+#else
+
+#define MRTP_TRACE_SCOPE(name) ((void)0)
+#define MRTP_TRACE_SCOPE_ARG(name, arg) ((void)0)
+#define MRTP_TRACE_SCOPE_TEXT(name, text) ((void)0)
+
+#endif //MRTP_TRACE
+
+#endif //_TRACE_H
@@ -0,0 +1,61 @@
+/* File      : wavefront.hpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#ifndef _WAVEFRONT_H
+#define _WAVEFRONT_H
+
+#include <Eigen/Core>
+
+#include "actor.hpp"
+#include "pixel.hpp"
+
+
+namespace mrtp {
+
+enum RaySort_t {so_none, so_actor, so_direction};
+
+/*
+A ray waiting in a queue of the wavefront renderer. path
+is the pixel within the tile the ray contributes to,
+parent the actor it was reflected from, if any.
+*/
+struct WaveRay {
+    WaveRay();
+
+    Eigen::Vector3f origin;
+    Eigen::Vector3f direction;
+    int path;
+    int depth;
+    Actor *parent;
+
+    // Filled in by the intersection and shading stages
+    Actor *hit;
+    float currd;
+    Eigen::Vector3f inter;
+    Eigen::Vector3f normal;
+    Eigen::Vector3f corr;
+    Eigen::Vector3f tolight;
+    float lightd;
+    float intensity;
+    bool isshadow;
+    float footprint;
+
+    // Shading of all lights, if the scene has several
+    Pixel local;
+};
+
+/*
+Shading of one path at one depth. Colors of a path are
+combined from the deepest step up, the same way as
+reflected rays are combined by the recursive renderer.
+*/
+struct WaveStep {
+    Pixel local;
+    float coeff;
+};
+
+} //namespace mrtp
+
+#endif //_WAVEFRONT_H
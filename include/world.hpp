@@ -12,9 +12,11 @@
 #include "cpptoml.h"
 
 #include "actor.hpp"
+#include "bvh.hpp"
 #include "camera.hpp"
 #include "cylinder.hpp"
 #include "light.hpp"
+#include "lighttree.hpp"
 #include "plane.hpp"
 #include "sphere.hpp"
 
@@ -36,13 +38,19 @@ class World {
 
     Camera *ptr_camera_;
     Light *ptr_light_;
+    std::vector<Light *> ptr_lights_;
+    LightTree lighttree_;
     std::vector<Actor *> ptr_actors_;
+    Bvh bvh_;
+    Bvh occluders_;
 
   private:
+    WorldStatus_t load_light(std::shared_ptr<cpptoml::table> items);
     WorldStatus_t load_plane(std::shared_ptr<cpptoml::table> items);
     WorldStatus_t load_sphere(std::shared_ptr<cpptoml::table> items);
     WorldStatus_t load_cylinder(std::shared_ptr<cpptoml::table> items);
     
+    WorldStatus_t load_lights(std::shared_ptr<cpptoml::table_array> array);
     WorldStatus_t load_planes(std::shared_ptr<cpptoml::table_array> array);
     WorldStatus_t load_spheres(std::shared_ptr<cpptoml::table_array> array);
     WorldStatus_t load_cylinders(std::shared_ptr<cpptoml::table_array> array);
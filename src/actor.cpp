@@ -15,33 +15,12 @@ Actor::Actor() {}
 
 Actor::~Actor() {}
 
+ActorType_t Actor::get_type() { return type_; }
+
 bool Actor::has_shadow() { return has_shadow_; }
 
 float Actor::get_reflect() { return reflect_; }
 
-float Actor::solve_quadratic(float a, float b, float c, float mint,
-                             float maxt) {
-    float t = -1.0f;
-    float delta = b * b - 4.0f * a * c;
-
-    if (delta >= 0.0f) {
-        if (delta > 0.0f) {
-            float sqdelta = sqrt(delta);
-            float tmp = 0.5f / a;
-            float ta = (-b - sqdelta) * tmp;
-            float tb = (-b + sqdelta) * tmp;
-            t = (ta < tb) ? ta : tb;
-        } else {
-            t = -b / (2.0f * a);
-        }
-
-        if ((t < mint) || (t > maxt)) {
-            t = -1.0f;
-        }
-    }
-    return t;
-}
-
 Eigen::Vector3f Actor::generate_unit_vector(Eigen::Vector3f *vector) {
     float tx = (*vector)[0];
     float ty = (*vector)[1];
@@ -0,0 +1,610 @@
+/* File      : bvh.cpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#include <algorithm>
+#include <atomic>
+
+#include "bvh.hpp"
+#include "primitives.hpp"
+#include "profile.hpp"
+#include "trace.hpp"
+
+
+namespace mrtp {
+
+static const int kLeafSize = 2;
+static const int kMaxLeafSize = 8;
+static const int kBins = 12;
+static const int kStackSize = 64;
+static const int kMaxDepth = 40;
+
+// Serial numbers of builds, 0 marks an empty cache
+static std::atomic<unsigned long> nextSerial(1);
+
+/*
+Primitives tested in a leaf, counted with statistics on.
+*/
+static inline int leaf_tests(BvhNode *node) {
+    return (node->sphere_last - node->sphere_first) +
+           (node->cylinder_last - node->cylinder_first);
+}
+
+struct BoundedActor {
+    Actor *actor;
+    Eigen::Vector3f lower;
+    Eigen::Vector3f upper;
+    Eigen::Vector3f centroid;
+};
+
+static float farthest(RayPacket *packet) {
+    float maxd = 0.0f;
+    for (int i = 0; i < packet->size; i++) {
+        if (packet->active[i] && (packet->currd[i] > maxd)) { maxd = packet->currd[i]; }
+    }
+    return maxd;
+}
+
+/*
+Retires lanes of a shadow packet that are already occluded.
+Returns false if no lanes are left.
+*/
+static bool retire_lanes(RayPacket *packet) {
+    int any = 0;
+    for (int i = 0; i < packet->size; i++) {
+        if (packet->hit[i]) { packet->active[i] = 0; }
+        any |= packet->active[i];
+    }
+    return any != 0;
+}
+
+static float half_area(Eigen::Vector3f *lower, Eigen::Vector3f *upper) {
+    Eigen::Vector3f extent = (*upper) - (*lower);
+    return extent[0] * extent[1] + extent[1] * extent[2] + extent[2] * extent[0];
+}
+
+/*
+Builds a subtree over items [first, first + count) and
+returns the index of its root node.
+
+Nodes are stored depth-first, so the left child of an
+inner node always follows its parent. Until primitives
+are compiled, a leaf keeps its range of items in the
+sphere fields.
+
+Splits are chosen with a binned surface area heuristic
+over centroids. Deep subtrees fall back to median splits
+to keep the traversal stack bounded.
+*/
+static int build_r(std::vector<BoundedActor> *items, std::vector<BvhNode> *nodes,
+                   int first, int count, int depth) {
+    BoundedActor *item = &(*items)[first];
+    BvhNode node;
+    node.lower = item->lower;
+    node.upper = item->upper;
+    Eigen::Vector3f clower = item->centroid;
+    Eigen::Vector3f cupper = item->centroid;
+
+    for (int i = 1; i < count; i++) {
+        item = &(*items)[first + i];
+        node.lower = node.lower.cwiseMin(item->lower);
+        node.upper = node.upper.cwiseMax(item->upper);
+        clower = clower.cwiseMin(item->centroid);
+        cupper = cupper.cwiseMax(item->centroid);
+    }
+    node.right = 0;
+    node.sphere_first = first;
+    node.sphere_last = first + count;
+    node.cylinder_first = 0;
+    node.cylinder_last = 0;
+
+    int index = static_cast<int>(nodes->size());
+    nodes->push_back(node);
+
+    if (count <= kLeafSize) { return index; }
+
+    int axis;
+    Eigen::Vector3f extent = cupper - clower;
+    float width = extent.maxCoeff(&axis);
+    if (width <= 0.0f) {
+        // All centroids coincide, no split is possible
+        if (count <= kMaxLeafSize) { return index; }
+    }
+
+    int split = -1;
+
+    if ((width > 0.0f) && (depth < kMaxDepth)) {
+        int bcount[kBins] = {0};
+        Eigen::Vector3f blower[kBins];
+        Eigen::Vector3f bupper[kBins];
+        float scale = kBins / width;
+
+        for (int i = 0; i < count; i++) {
+            item = &(*items)[first + i];
+            int bin = std::min(kBins - 1, static_cast<int>((item->centroid[axis] - clower[axis]) * scale));
+            if (bcount[bin] == 0) {
+                blower[bin] = item->lower;
+                bupper[bin] = item->upper;
+            } else {
+                blower[bin] = blower[bin].cwiseMin(item->lower);
+                bupper[bin] = bupper[bin].cwiseMax(item->upper);
+            }
+            bcount[bin]++;
+        }
+
+        // Sweep from the right to collect costs of right halves
+        float rcost[kBins];
+        int nright = 0;
+        Eigen::Vector3f rlower, rupper;
+        for (int i = kBins - 1; i > 0; i--) {
+            if (bcount[i]) {
+                rlower = (nright) ? rlower.cwiseMin(blower[i]) : blower[i];
+                rupper = (nright) ? rupper.cwiseMax(bupper[i]) : bupper[i];
+                nright += bcount[i];
+            }
+            rcost[i] = (nright) ? nright * half_area(&rlower, &rupper) : 0.0f;
+        }
+
+        float best = -1.0f;
+        int bestbin = 0;
+        int nleft = 0;
+        Eigen::Vector3f llower, lupper;
+        for (int i = 0; i < kBins - 1; i++) {
+            if (bcount[i]) {
+                llower = (nleft) ? llower.cwiseMin(blower[i]) : blower[i];
+                lupper = (nleft) ? lupper.cwiseMax(bupper[i]) : bupper[i];
+                nleft += bcount[i];
+            }
+            if ((nleft == 0) || (nleft == count)) { continue; }
+            float cost = nleft * half_area(&llower, &lupper) + rcost[i + 1];
+            if ((best < 0.0f) || (cost < best)) {
+                best = cost;
+                bestbin = i;
+            }
+        }
+
+        // Keep a leaf if splitting does not pay off
+        float leafcost = count * half_area(&node.lower, &node.upper);
+        if ((count <= kMaxLeafSize) && ((best < 0.0f) || (best >= leafcost))) {
+            return index;
+        }
+
+        if (best >= 0.0f) {
+            BoundedActor *middle = std::partition(&(*items)[first], &(*items)[first] + count,
+                [=](const BoundedActor &b) {
+                    int bin = std::min(kBins - 1, static_cast<int>((b.centroid[axis] - clower[axis]) * scale));
+                    return bin <= bestbin;
+                });
+            split = static_cast<int>(middle - &(*items)[0]);
+        }
+    }
+
+    if ((split <= first) || (split >= first + count)) {
+        // Degenerate partition, fall back to a median split
+        split = first + count / 2;
+        std::nth_element(&(*items)[first], &(*items)[split], &(*items)[first] + count,
+            [=](const BoundedActor &a, const BoundedActor &b) {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+    }
+
+    build_r(items, nodes, first, split - first, depth + 1);
+    int right = build_r(items, nodes, split, first + count - split, depth + 1);
+
+    (*nodes)[index].right = right;
+    return index;
+}
+
+//Member functions
+
+Bvh::Bvh() : serial_(0), ninfinite_(0) {}
+
+Bvh::~Bvh() {}
+
+/*
+Splits actors into bounded ones, which go into the
+hierarchy, and unbounded ones (planes, infinite cylinders),
+which are always tested.
+
+Actors are then compiled into arrays of primitives in
+the order of leaves, so that each leaf refers to a range
+of spheres and a range of cylinders. Infinite cylinders
+come first in the array of cylinders.
+*/
+void Bvh::build(std::vector<Actor *> *actors) {
+    MRTP_TRACE_SCOPE("build bvh");
+    std::vector<BoundedActor> items;
+    serial_ = nextSerial.fetch_add(1);
+    nodes_.clear();
+    planes_.clear();
+    spheres_.clear();
+    cylinders_.clear();
+
+    std::vector<Actor *>::iterator iter = actors->begin();
+    std::vector<Actor *>::iterator iter_end = actors->end();
+
+    for (; iter != iter_end; ++iter) {
+        BoundedActor item;
+        item.actor = *iter;
+        if (item.actor->calculate_bounds(&item.lower, &item.upper)) {
+            item.centroid = 0.5f * (item.lower + item.upper);
+            items.push_back(item);
+        } else if (item.actor->get_type() == at_plane) {
+            planes_.add(static_cast<Plane *>(item.actor));
+        } else if (item.actor->get_type() == at_cylinder) {
+            cylinders_.add(static_cast<Cylinder *>(item.actor));
+        }
+    }
+    ninfinite_ = static_cast<int>(cylinders_.actors.size());
+
+    if (items.empty()) {
+        index_slots();
+        return;
+    }
+
+    nodes_.reserve(2 * items.size());
+    build_r(&items, &nodes_, 0, static_cast<int>(items.size()), 0);
+
+    std::vector<BvhNode>::iterator node = nodes_.begin();
+    std::vector<BvhNode>::iterator node_end = nodes_.end();
+
+    for (; node != node_end; ++node) {
+        if (node->right) { continue; }
+        int first = node->sphere_first;
+        int last = node->sphere_last;
+
+        node->sphere_first = static_cast<int>(spheres_.actors.size());
+        node->cylinder_first = static_cast<int>(cylinders_.actors.size());
+
+        for (int i = first; i < last; i++) {
+            Actor *actor = items[i].actor;
+            if (actor->get_type() == at_sphere) {
+                spheres_.add(static_cast<Sphere *>(actor));
+            } else if (actor->get_type() == at_cylinder) {
+                cylinders_.add(static_cast<Cylinder *>(actor));
+            }
+        }
+        node->sphere_last = static_cast<int>(spheres_.actors.size());
+        node->cylinder_last = static_cast<int>(cylinders_.actors.size());
+    }
+    index_slots();
+}
+
+/*
+Records where each actor went in the compiled arrays,
+so that the occluder cache can refer to it.
+*/
+void Bvh::index_slots() {
+    slots_.clear();
+    for (int i = 0; i < static_cast<int>(planes_.actors.size()); i++) {
+        slots_[planes_.actors[i]] = i;
+    }
+    for (int i = 0; i < static_cast<int>(spheres_.actors.size()); i++) {
+        slots_[spheres_.actors[i]] = i;
+    }
+    for (int i = 0; i < static_cast<int>(cylinders_.actors.size()); i++) {
+        slots_[cylinders_.actors[i]] = i;
+    }
+}
+
+bool Bvh::hit_box(BvhNode *node, Eigen::Vector3f *origin, Eigen::Vector3f *inverse,
+                  float maxd, float *entry) {
+    Eigen::Vector3f ta = (node->lower - (*origin)).cwiseProduct(*inverse);
+    Eigen::Vector3f tb = (node->upper - (*origin)).cwiseProduct(*inverse);
+
+    float tmin = ta.cwiseMin(tb).maxCoeff();
+    float tmax = ta.cwiseMax(tb).minCoeff();
+
+    if (tmin < 0.0f) { tmin = 0.0f; }
+    if (tmax > maxd) { tmax = maxd; }
+    *entry = tmin;
+    return tmin <= tmax;
+}
+
+/*
+Tests the primitives of a leaf and returns the closest
+one hit before currd, or the previous hit.
+*/
+Actor *Bvh::solve_leaf(BvhNode *node, Eigen::Vector3f *origin,
+                       Eigen::Vector3f *direction, float maxd, float *currd,
+                       Actor *hit) {
+    count_tests(leaf_tests(node));
+    int index = solve_spheres(&spheres_, node->sphere_first, node->sphere_last,
+                              origin, direction, maxd, currd);
+    if (index >= 0) { hit = spheres_.actors[index]; }
+
+    index = solve_cylinders(&cylinders_, node->cylinder_first, node->cylinder_last,
+                            origin, direction, maxd, currd);
+    if (index >= 0) { hit = cylinders_.actors[index]; }
+
+    return hit;
+}
+
+/*
+Returns the closest actor hit by a ray or nullptr.
+On input, currd is the maximum distance to consider.
+On output, it is the distance to the hit actor.
+*/
+Actor *Bvh::solve_hits(Eigen::Vector3f *origin, Eigen::Vector3f *direction,
+                       float *currd) {
+    Actor *hit = nullptr;
+    float maxd = *currd;
+    int nplanes = static_cast<int>(planes_.actors.size());
+
+    count_tests(nplanes + ninfinite_);
+    int index = solve_planes(&planes_, 0, nplanes, origin, direction, maxd, currd);
+    if (index >= 0) { hit = planes_.actors[index]; }
+
+    index = solve_cylinders(&cylinders_, 0, ninfinite_, origin, direction, maxd, currd);
+    if (index >= 0) { hit = cylinders_.actors[index]; }
+
+    if (nodes_.empty()) { return hit; }
+
+    Eigen::Vector3f inverse = direction->cwiseInverse();
+    int stack[kStackSize];
+    float entries[kStackSize];
+    int top = 0;
+    float entry;
+
+    if (!hit_box(&nodes_[0], origin, &inverse, *currd, &entry)) { return hit; }
+    BvhNode *node = &nodes_[0];
+
+    while (true) {
+        if (!node->right) {
+            hit = solve_leaf(node, origin, direction, maxd, currd, hit);
+        } else {
+            BvhNode *left = node + 1;
+            BvhNode *right = &nodes_[node->right];
+            float eleft, eright;
+            bool hleft = hit_box(left, origin, &inverse, *currd, &eleft);
+            bool hright = hit_box(right, origin, &inverse, *currd, &eright);
+
+            if (hleft && hright) {
+                // Visit the nearer child first
+                if (eright < eleft) {
+                    std::swap(left, right);
+                    std::swap(eleft, eright);
+                }
+                stack[top] = static_cast<int>(right - &nodes_[0]);
+                entries[top++] = eright;
+                node = left;
+                continue;
+            } else if (hleft) {
+                node = left;
+                continue;
+            } else if (hright) {
+                node = right;
+                continue;
+            }
+        }
+
+        // Pop nodes that cannot contain a closer hit
+        while ((top > 0) && (entries[top - 1] > (*currd))) { top--; }
+        if (top == 0) { break; }
+        node = &nodes_[stack[--top]];
+    }
+    return hit;
+}
+
+/*
+Returns true if any shadow casting actor lies between
+the origin and maxd along the direction. If cache is
+not null, its actor is tested first and replaced by
+the occluder found otherwise.
+*/
+bool Bvh::solve_shadows(Eigen::Vector3f *origin, Eigen::Vector3f *direction,
+                        float maxd, OccluderCache *cache) {
+    if (cache && test_cached(cache, origin, direction, maxd)) { return true; }
+
+    Actor *occluder = find_occluder(origin, direction, maxd);
+    if (cache && occluder) { update_cache(cache, occluder); }
+    return occluder != nullptr;
+}
+
+bool Bvh::test_cached(OccluderCache *cache, Eigen::Vector3f *origin,
+                      Eigen::Vector3f *direction, float maxd) {
+    if (cache->serial != serial_) { return false; }
+
+    int i = cache->index;
+    count_tests(1);
+    if (cache->type == at_plane) {
+        return occlude_planes(&planes_, i, i + 1, origin, direction, maxd) >= 0;
+    } else if (cache->type == at_sphere) {
+        return occlude_spheres(&spheres_, i, i + 1, origin, direction, maxd) >= 0;
+    }
+    return occlude_cylinders(&cylinders_, i, i + 1, origin, direction, maxd) >= 0;
+}
+
+void Bvh::test_cached_packet(OccluderCache *cache, RayPacket *packet) {
+    if (cache->serial != serial_) { return; }
+
+    int i = cache->index;
+    count_tests(packet->size);
+    if (cache->type == at_plane) {
+        packet_solve_planes(packet, &planes_, i, i + 1, true);
+    } else if (cache->type == at_sphere) {
+        packet_solve_spheres(packet, &spheres_, i, i + 1, true);
+    } else {
+        packet_solve_cylinders(packet, &cylinders_, i, i + 1, true);
+    }
+}
+
+/*
+Called by all rendering threads, so slots are only
+looked up. Occluders of another hierarchy are not cached.
+*/
+void Bvh::update_cache(OccluderCache *cache, Actor *occluder) {
+    std::unordered_map<Actor *, int>::const_iterator found = slots_.find(occluder);
+    if (found == slots_.end()) { return; }
+
+    cache->serial = serial_;
+    cache->type = occluder->get_type();
+    cache->index = found->second;
+}
+
+/*
+Returns the first shadow casting actor found between
+the origin and maxd, not necessarily the closest one.
+*/
+Actor *Bvh::find_occluder(Eigen::Vector3f *origin, Eigen::Vector3f *direction,
+                          float maxd) {
+    int nplanes = static_cast<int>(planes_.actors.size());
+
+    count_tests(nplanes);
+    int index = occlude_planes(&planes_, 0, nplanes, origin, direction, maxd);
+    if (index >= 0) { return planes_.actors[index]; }
+
+    count_tests(ninfinite_);
+    index = occlude_cylinders(&cylinders_, 0, ninfinite_, origin, direction, maxd);
+    if (index >= 0) { return cylinders_.actors[index]; }
+
+    if (nodes_.empty()) { return nullptr; }
+
+    Eigen::Vector3f inverse = direction->cwiseInverse();
+    int stack[kStackSize];
+    int top = 0;
+    float entry;
+
+    stack[top++] = 0;
+
+    while (top > 0) {
+        BvhNode *node = &nodes_[stack[--top]];
+        if (!hit_box(node, origin, &inverse, maxd, &entry)) { continue; }
+
+        if (!node->right) {
+            count_tests(leaf_tests(node));
+            index = occlude_spheres(&spheres_, node->sphere_first, node->sphere_last,
+                                    origin, direction, maxd);
+            if (index >= 0) { return spheres_.actors[index]; }
+
+            index = occlude_cylinders(&cylinders_, node->cylinder_first, node->cylinder_last,
+                                      origin, direction, maxd);
+            if (index >= 0) { return cylinders_.actors[index]; }
+        } else {
+            stack[top++] = node->right;
+            stack[top++] = static_cast<int>(node - &nodes_[0]) + 1;
+        }
+    }
+    return nullptr;
+}
+
+/*
+Packet version of solve_hits. Each lane keeps its own
+closest hit, a node is visited if any lane enters it.
+*/
+void Bvh::solve_hits_packet(RayPacket *packet) {
+    int nplanes = static_cast<int>(planes_.actors.size());
+
+    count_tests(static_cast<long long>(nplanes + ninfinite_) * packet->size);
+    packet_solve_planes(packet, &planes_, 0, nplanes, false);
+    packet_solve_cylinders(packet, &cylinders_, 0, ninfinite_, false);
+    if (nodes_.empty()) { return; }
+
+    int stack[kStackSize];
+    float entries[kStackSize];
+    int top = 0;
+    float entry;
+
+    BvhNode *node = &nodes_[0];
+    if (!packet_hit_box(packet, node->lower.data(), node->upper.data(), &entry)) { return; }
+
+    while (true) {
+        if (!node->right) {
+            count_tests(static_cast<long long>(leaf_tests(node)) * packet->size);
+            packet_solve_spheres(packet, &spheres_, node->sphere_first, node->sphere_last, false);
+            packet_solve_cylinders(packet, &cylinders_, node->cylinder_first, node->cylinder_last, false);
+        } else {
+            BvhNode *left = node + 1;
+            BvhNode *right = &nodes_[node->right];
+            float eleft, eright;
+            bool hleft = packet_hit_box(packet, left->lower.data(), left->upper.data(), &eleft);
+            bool hright = packet_hit_box(packet, right->lower.data(), right->upper.data(), &eright);
+
+            if (hleft && hright) {
+                if (eright < eleft) {
+                    std::swap(left, right);
+                    std::swap(eleft, eright);
+                }
+                stack[top] = static_cast<int>(right - &nodes_[0]);
+                entries[top++] = eright;
+                node = left;
+                continue;
+            } else if (hleft) {
+                node = left;
+                continue;
+            } else if (hright) {
+                node = right;
+                continue;
+            }
+        }
+
+        if (top == 0) { break; }
+        float maxd = farthest(packet);
+        while ((top > 0) && (entries[top - 1] > maxd)) { top--; }
+        if (top == 0) { break; }
+        node = &nodes_[stack[--top]];
+    }
+}
+
+/*
+Packet version of solve_shadows. On input, currd of each
+active lane holds the distance to the light. On output,
+hit is set for lanes that are in a shadow.
+
+The cached actor is tested on all lanes before the
+traversal, the cache then keeps an occluder of the
+packet, if any.
+*/
+void Bvh::solve_shadows_packet(RayPacket *packet, OccluderCache *cache) {
+    if (cache) { test_cached_packet(cache, packet); }
+
+    find_occluders_packet(packet);
+    if (!cache) { return; }
+
+    for (int i = 0; i < packet->size; i++) {
+        if (packet->hit[i]) {
+            update_cache(cache, packet->hit[i]);
+            break;
+        }
+    }
+}
+
+void Bvh::find_occluders_packet(RayPacket *packet) {
+    int nplanes = static_cast<int>(planes_.actors.size());
+
+    if (!retire_lanes(packet)) { return; }
+
+    count_tests(static_cast<long long>(nplanes) * packet->size);
+    packet_solve_planes(packet, &planes_, 0, nplanes, true);
+    if (!retire_lanes(packet)) { return; }
+
+    count_tests(static_cast<long long>(ninfinite_) * packet->size);
+    packet_solve_cylinders(packet, &cylinders_, 0, ninfinite_, true);
+    if (!retire_lanes(packet)) { return; }
+
+    if (nodes_.empty()) { return; }
+
+    int stack[kStackSize];
+    int top = 0;
+    float entry;
+
+    stack[top++] = 0;
+
+    while (top > 0) {
+        BvhNode *node = &nodes_[stack[--top]];
+        if (!packet_hit_box(packet, node->lower.data(), node->upper.data(), &entry)) { continue; }
+
+        if (!node->right) {
+            count_tests(static_cast<long long>(leaf_tests(node)) * packet->size);
+            packet_solve_spheres(packet, &spheres_, node->sphere_first, node->sphere_last, true);
+            packet_solve_cylinders(packet, &cylinders_, node->cylinder_first, node->cylinder_last, true);
+            if (!retire_lanes(packet)) { return; }
+        } else {
+            stack[top++] = node->right;
+            stack[top++] = static_cast<int>(node - &nodes_[0]) + 1;
+        }
+    }
+}
+
+} //namespace mrtp
@@ -58,9 +58,19 @@ Eigen::Vector3f Camera::calculate_origin(int windowx, int windowy) {
     return (wo_ + static_cast<float>(windowx) * wh_ + static_cast<float>(windowy) * wv_);
 }
 
+/*
+Same as calculate_origin, at a fractional position
+in the window, for extra samples within a pixel.
+*/
+Eigen::Vector3f Camera::calculate_subpixel(float windowx, float windowy) {
+    return (wo_ + windowx * wh_ + windowy * wv_);
+}
+
 Eigen::Vector3f Camera::calculate_direction(Eigen::Vector3f *origin) {
     Eigen::Vector3f direction = (*origin) - eye_;
     return (direction * (1.0f / direction.norm()));
 }
 
+Eigen::Vector3f Camera::get_eye() { return eye_; }
+
 } //namespace mrtp
@@ -12,20 +12,21 @@
 namespace mrtp {
 
 Cylinder::Cylinder(Eigen::Vector3f *center, Eigen::Vector3f *direction, float radius, 
-                   float span, float reflect, const char *texture) {
+                   float span, float reflect, const char *texture, TexelFormat_t format) {
     A_ = *center;
     B_ = *direction;
     B_ *= (1.0f / B_.norm());
     R_ = radius;
     span_ = span;
     reflect_ = reflect;
+    type_ = at_cylinder;
     has_shadow_ = true;
 
     ty_ = generate_unit_vector(&B_);
     tx_ = ty_.cross(B_);
     tx_ *= (1.0f / tx_.norm());
 
-    texture_ = textureCollector.add(texture);
+    texture_ = textureCollector.add(texture, format);
 }
 
 Cylinder::~Cylinder() {}
@@ -85,6 +86,14 @@ float Cylinder::solve(Eigen::Vector3f *O, Eigen::Vector3f *D, float mind, float
     return t;
 }
 
+Eigen::Vector3f Cylinder::get_center() { return A_; }
+
+Eigen::Vector3f Cylinder::get_direction() { return B_; }
+
+float Cylinder::get_radius() { return R_; }
+
+float Cylinder::get_span() { return span_; }
+
 Eigen::Vector3f Cylinder::calculate_normal(Eigen::Vector3f *hit) {
     // N = Hit - [B . (Hit - A)] * B
     Eigen::Vector3f tmp = (*hit) - A_;
@@ -95,13 +104,34 @@ Eigen::Vector3f Cylinder::calculate_normal(Eigen::Vector3f *hit) {
     return (normal * (1.0f / normal.norm()));
 }
 
-Pixel Cylinder::pick_pixel(Eigen::Vector3f *hit, Eigen::Vector3f *normal) {
+/*
+Only finite cylinders are bounded. The extent of a
+circular rim along each axis is R * sqrt(1 - B_i^2).
+*/
+bool Cylinder::calculate_bounds(Eigen::Vector3f *lower, Eigen::Vector3f *upper) {
+    if (span_ <= 0.0f) { return false; }
+
+    Eigen::Vector3f top = A_ + span_ * B_;
+    Eigen::Vector3f bottom = A_ - span_ * B_;
+    Eigen::Vector3f rim = (Eigen::Vector3f::Ones() - B_.cwiseProduct(B_)).cwiseMax(0.0f).cwiseSqrt() * R_;
+
+    *lower = top.cwiseMin(bottom) - rim;
+    *upper = top.cwiseMax(bottom) + rim;
+    return true;
+}
+
+Pixel Cylinder::pick_pixel(Eigen::Vector3f *hit, Eigen::Vector3f *normal, float footprint) {
     Eigen::Vector3f tmp = (*hit) - A_;
     float alpha = tmp.dot(B_);
     float dot = normal->dot(tx_);
     float fracx = acos(dot) / M_PI;
     float fracy = alpha / (2.0f * M_PI * R_);
 
+    // Texture spans half of the circumference in x
+    if (footprint > 0.0f) {
+        float footx = footprint / (M_PI * R_);
+        return texture_->filter_pixel(fracx, fracy, 1.0f, footx, 0.5f * footx);
+    }
     return texture_->pick_pixel(fracx, fracy, 1.0f);
 }
 
@@ -0,0 +1,94 @@
+/* File      : heatmap.cpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+#include "png.hpp"
+#include "renderer.hpp"
+
+
+namespace mrtp {
+
+static const float kRealToByte = 255.0f;
+
+// Colors from no cost to the highest cost, dark to bright
+static const int kRampStops = 5;
+static const float kRamp[kRampStops][3] = {
+    {0.0f, 0.0f, 0.02f},
+    {0.34f, 0.06f, 0.43f},
+    {0.73f, 0.21f, 0.33f},
+    {0.98f, 0.55f, 0.04f},
+    {0.99f, 1.0f, 0.64f}
+};
+
+/*
+Color of a cost between <0..1> on the ramp.
+*/
+static png::rgb_pixel heat_color(float cost) {
+    float position = std::min(std::max(cost, 0.0f), 1.0f) * (kRampStops - 1);
+    int stop = std::min(static_cast<int>(position), kRampStops - 2);
+    float t = position - stop;
+
+    unsigned char rgb[3];
+    for (int k = 0; k < 3; k++) {
+        float value = (1.0f - t) * kRamp[stop][k] + t * kRamp[stop + 1][k];
+        rgb[k] = static_cast<unsigned char>(kRealToByte * value);
+    }
+    return png::rgb_pixel(rgb[0], rgb[1], rgb[2]);
+}
+
+/*
+Writes the costs of tiles recorded in the last rendering:
+a PNG image of the size of the output, each tile in the
+color of its cost per pixel, and a CSV file with a row
+per tile in scanline order. Costs of the shadow map are
+not part of any tile.
+*/
+bool Renderer::write_heatmap(const char *pngpath, const char *csvpath) {
+    if (tilecosts_.empty()) { return rs_fail; }
+
+    std::vector<float> density(ntiles_);
+    float highest = 0.0f;
+
+    for (long long k = 0; k < ntiles_; k++) {
+        int x = static_cast<int>(k % tilecols_) * tilesize_;
+        int y = static_cast<int>(k / tilecols_) * tilesize_;
+        float npixels = static_cast<float>(std::min(tilesize_, width_ - x) *
+                                           std::min(tilesize_, height_ - y));
+        float cost = (heatmap_ == hm_tests) ? static_cast<float>(tilecosts_[k].tests) :
+                                              static_cast<float>(tilecosts_[k].nanos);
+        density[k] = cost / npixels;
+        highest = std::max(highest, density[k]);
+    }
+
+    png::image<png::rgb_pixel> image(width_, height_);
+    for (int j = 0; j < height_; j++) {
+        const float *row = &density[(j / tilesize_) * tilecols_];
+        for (int i = 0; i < width_; i++) {
+            float cost = (highest > 0.0f) ? row[i / tilesize_] / highest : 0.0f;
+            image[j][i] = heat_color(cost);
+        }
+    }
+    image.write(pngpath);
+
+    std::ofstream csv(csvpath);
+    if (!csv) { return rs_fail; }
+
+    csv << "tile,x,y,width,height,seconds,tests,rays" << std::endl;
+    csv << std::setprecision(6);
+    for (long long k = 0; k < ntiles_; k++) {
+        int x = static_cast<int>(k % tilecols_) * tilesize_;
+        int y = static_cast<int>(k / tilecols_) * tilesize_;
+        csv << k << "," << x << "," << y << "," << std::min(tilesize_, width_ - x) << ","
+            << std::min(tilesize_, height_ - y) << ","
+            << 1.0e-9 * static_cast<double>(tilecosts_[k].nanos) << ","
+            << tilecosts_[k].tests << "," << tilecosts_[k].rays << std::endl;
+    }
+    return (csv) ? rs_ok : rs_fail;
+}
+
+} //namespace mrtp
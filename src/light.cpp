@@ -8,10 +8,18 @@
 
 namespace mrtp {
 
-Light::Light(Eigen::Vector3f *center) : center_(*center) {}
+/*
+power scales the light reaching actors, 1 is the
+brightness of a single scene light.
+*/
+Light::Light(Eigen::Vector3f *center, float power) : center_(*center), power_(power) {}
 
 Light::~Light() {}
 
 Eigen::Vector3f Light::calculate_ray(Eigen::Vector3f *hit) { return (center_ - (*hit)); }
 
+Eigen::Vector3f Light::get_center() { return center_; }
+
+float Light::get_power() { return power_; }
+
 } //namespace mrtp
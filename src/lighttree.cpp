@@ -0,0 +1,242 @@
+/* File      : lighttree.cpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "lighttree.hpp"
+
+
+namespace mrtp {
+
+static const float kRandomScale = 1.0f / 16777216.0f;
+
+/*
+Seed of the light samples at a point. Samples depend
+only on the point, not on the thread or the order of
+rendering, so images are reproducible.
+*/
+static unsigned int point_hash(Eigen::Vector3f *point) {
+    std::uint32_t bits[3];
+    std::memcpy(bits, point->data(), sizeof(bits));
+
+    std::uint32_t hash = (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return (hash) ? hash : 1u;
+}
+
+/*
+Xorshift generator, returns a number in <0..1).
+*/
+static float next_random(unsigned int *state) {
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return static_cast<float>(x >> 8) * kRandomScale;
+}
+
+LightNode::LightNode() :
+    center(Eigen::Vector3f::Zero()), radius(0.0f), power(0.0f), right(0), light(-1) {}
+
+LightTree::LightTree() {}
+
+LightTree::~LightTree() {}
+
+/*
+Builds the tree top-down, splitting lights at the median
+of their centers along the longest axis.
+*/
+void LightTree::build(std::vector<Light *> *lights) {
+    lights_ = *lights;
+    nodes_.clear();
+    if (lights_.empty()) { return; }
+
+    std::vector<int> order(lights_.size());
+    for (size_t i = 0; i < order.size(); i++) { order[i] = static_cast<int>(i); }
+
+    nodes_.reserve(2 * lights_.size() - 1);
+    build_node(&order, 0, static_cast<int>(order.size()));
+}
+
+int LightTree::build_node(std::vector<int> *order, int first, int last) {
+    int index = static_cast<int>(nodes_.size());
+    nodes_.push_back(LightNode());
+
+    Eigen::Vector3f lower = lights_[(*order)[first]]->get_center();
+    Eigen::Vector3f upper = lower;
+    float power = 0.0f;
+
+    for (int i = first; i < last; i++) {
+        Light *light = lights_[(*order)[i]];
+        Eigen::Vector3f center = light->get_center();
+        lower = lower.cwiseMin(center);
+        upper = upper.cwiseMax(center);
+        power += light->get_power();
+    }
+
+    int right = 0;
+    int light = -1;
+
+    if (last - first == 1) {
+        light = (*order)[first];
+    } else {
+        int axis;
+        (upper - lower).maxCoeff(&axis);
+        int middle = (first + last) / 2;
+
+        std::nth_element(order->begin() + first, order->begin() + middle,
+                         order->begin() + last, [this, axis](int a, int b) {
+            return lights_[a]->get_center()[axis] < lights_[b]->get_center()[axis];
+        });
+        build_node(order, first, middle);
+        right = build_node(order, middle, last);
+    }
+
+    LightNode *node = &nodes_[index];
+    node->center = 0.5f * (lower + upper);
+    node->radius = 0.5f * (upper - lower).norm();
+    node->power = power;
+    node->right = right;
+    node->light = light;
+    return index;
+}
+
+/*
+Upper estimate of the light reaching point from the
+lights of a node: their power, the falloff at the
+closest distance to their bounds and the cosine of the
+smallest angle between the normal and the bounds.
+Zero if no light of the node can contribute.
+*/
+float LightTree::importance(LightNode *node, Eigen::Vector3f *point,
+                            Eigen::Vector3f *normal, float maxd) {
+    Eigen::Vector3f delta = node->center - (*point);
+    float distance = delta.norm();
+    float closest = distance - node->radius;
+    if (closest >= maxd) { return 0.0f; }
+    if (closest <= 0.0f) { return node->power; }
+
+    float falloff = 1.0f - std::pow(closest / maxd, 2);
+    float cosine = 1.0f;
+
+    // Cosine of the angle to the center less the angular
+    // radius of the bounds, without inverse functions
+    float cosa = delta.dot(*normal) / distance;
+    float sinb = node->radius / distance;
+    float cosb = std::sqrt(1.0f - sinb * sinb);
+    if (cosa < cosb) {
+        float sina = std::sqrt(std::max(1.0f - cosa * cosa, 0.0f));
+        cosine = cosa * cosb + sina * sinb;
+        if (cosine <= 0.0f) { return 0.0f; }
+    }
+    return node->power * falloff * cosine;
+}
+
+/*
+Picks one light below a node, going down the tree and
+choosing children in proportion to their importance.
+Returns false if no light of the node contributes.
+*/
+bool LightTree::sample_node(int index, Eigen::Vector3f *point, Eigen::Vector3f *normal,
+                            float maxd, unsigned int *state, LightSample *sample) {
+    LightNode *node = &nodes_[index];
+    float probability = 1.0f;
+
+    while (node->right) {
+        LightNode *left = node + 1;
+        LightNode *right = &nodes_[node->right];
+        float ileft = importance(left, point, normal, maxd);
+        float iright = importance(right, point, normal, maxd);
+        if (ileft + iright <= 0.0f) { return false; }
+
+        float pleft = ileft / (ileft + iright);
+        if (next_random(state) < pleft) {
+            node = left;
+            probability *= pleft;
+        } else {
+            node = right;
+            probability *= 1.0f - pleft;
+        }
+    }
+    sample->light = lights_[node->light];
+    sample->weight = 1.0f / probability;
+    return true;
+}
+
+/*
+Selects at most count lights to shade point with. The
+tree is cut into up to count nodes by repeatedly opening
+the most important inner node. Lights left in the cut
+are shaded exactly, each inner node adds one light
+sampled from below it. With at least as many samples
+as lights, all contributing lights are shaded exactly.
+
+Returns the number of samples.
+*/
+int LightTree::select(Eigen::Vector3f *point, Eigen::Vector3f *normal, float maxd,
+                      int count, LightSample *samples) {
+    int cut[kMaxLightSamples];
+    float weights[kMaxLightSamples];
+    int ncut = 0;
+
+    if (nodes_.empty()) { return 0; }
+
+    float root = importance(&nodes_[0], point, normal, maxd);
+    if (root > 0.0f) {
+        cut[0] = 0;
+        weights[0] = root;
+        ncut = 1;
+    }
+
+    // Opening a node adds at most one node to the cut
+    while (ncut < count) {
+        int best = -1;
+        for (int k = 0; k < ncut; k++) {
+            if (!nodes_[cut[k]].right) { continue; }
+            if ((best < 0) || (weights[k] > weights[best])) { best = k; }
+        }
+        if (best < 0) { break; }
+
+        int index = cut[best];
+        int children[2] = {index + 1, nodes_[index].right};
+        cut[best] = cut[ncut - 1];
+        weights[best] = weights[ncut - 1];
+        ncut--;
+
+        for (int c = 0; c < 2; c++) {
+            float weight = importance(&nodes_[children[c]], point, normal, maxd);
+            if (weight > 0.0f) {
+                cut[ncut] = children[c];
+                weights[ncut] = weight;
+                ncut++;
+            }
+        }
+    }
+
+    unsigned int state = point_hash(point);
+    int nsamples = 0;
+
+    for (int k = 0; k < ncut; k++) {
+        LightNode *node = &nodes_[cut[k]];
+        if (!node->right) {
+            samples[nsamples].light = lights_[node->light];
+            samples[nsamples].weight = 1.0f;
+            nsamples++;
+        } else if (sample_node(cut[k], point, normal, maxd, &state, &samples[nsamples])) {
+            nsamples++;
+        }
+    }
+    return nsamples;
+}
+
+} //namespace mrtp
@@ -3,15 +3,19 @@
  * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
  * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
  */
+#include <chrono>
 #include <iostream>
 #include <iomanip>
 #include <sstream>
 #include <string>
 #include <vector>
+#include <cmath>
 #include <cstdlib>
 
 #include "world.hpp"
 #include "renderer.hpp"
+#include "profile.hpp"
+#include "trace.hpp"
 
 
 //Default settings and limits
@@ -22,6 +26,7 @@ static const unsigned int kMinWidth = kDefaultWidth / 2;
 static const unsigned int kMaxWidth = kDefaultWidth * 10;
 static const unsigned int kMinHeight = kDefaultHeight / 2;
 static const unsigned int kMaxHeight = kDefaultHeight * 10;
+static const unsigned int kMaxOutOfCore = 1 << 20;
 
 static const unsigned int kDefaultRecursionLevels = 3;
 static const unsigned int kMinRecursionLevels = 0;
@@ -31,6 +36,31 @@ static const unsigned int kDefaultThreads = 1;
 static const unsigned int kMinThreads = 0;
 static const unsigned int kMaxThreads = 64;
 
+static const unsigned int kDefaultPacketSize = 0;
+
+static const unsigned int kDefaultTileSize = 32;
+static const unsigned int kMinTileSize = 4;
+static const unsigned int kMaxTileSize = 1024;
+
+static const unsigned int kDefaultMinSamples = 1;
+static const unsigned int kDefaultMaxSamples = 1;
+static const unsigned int kMaxSamples = 64;
+static const float kDefaultThreshold = 0.1f;
+
+static const unsigned int kDefaultStride = 1;
+static const unsigned int kMaxStride = 64;
+static const float kDefaultPreviewInterval = 5.0f;
+static const float kDefaultTimeBudget = 0.0f;
+
+static const unsigned int kDefaultMapSize = 0;
+static const unsigned int kMinMapSize = 16;
+static const unsigned int kMaxMapSize = 2048;
+static const float kDefaultMapBias = 0.05f;
+
+static const unsigned int kDefaultLightSamples = 8;
+static const unsigned int kMinLightSamples = 1;
+static const unsigned int kMaxLightSamples = 16;
+
 static const float kDefaultFOV = 93.0f;
 static const float kMinFOV = 50.0f;
 static const float kMaxFOV = 170.0f;
@@ -39,26 +69,71 @@ static const float kDefaultDistance = 60.0f;
 static const float kDefaultShadow = 0.25f;
 static const float kDefaultBias = 0.001f;
 
+//Extensions of output files, in order of mrtp::OutputFormat_t
+static const char *kOutputExtensions[] = {".png", ".ppm", ".pfm", ".raw"};
+static const int kOutputFormats = 4;
+
 //Exit codes
 
 enum ExitCode_t {exit_ok, exit_no_options, exit_unknown_option, exit_light_distance, 
                  exit_fov, exit_light_mode, exit_output_file, exit_resolution, 
                  exit_recursion_levels, exit_shadow_factor, exit_threads, exit_png, 
-                 exit_toml, exit_init_world, exit_write_scene};
-
+                 exit_toml, exit_init_world, exit_write_scene, exit_packet_size, 
+                 exit_tile_size, exit_tile_order, exit_backend, 
+                 exit_affinity, exit_antialias, exit_aa_threshold, 
+                 exit_progressive, exit_preview_file, exit_preview_interval, 
+                 exit_time_budget, exit_wavefront, exit_shadow_map, 
+                 exit_shadow_bias, exit_light_samples, exit_texture_filter,
+                 exit_texture_format, exit_texture_layout, exit_texture_cache,
+                 exit_texture_budget, exit_output_format, exit_out_of_core,
+                 exit_stats_json, exit_heatmap, exit_trace};
+
+
+static float seconds_since(std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
 
 void help_message() {
     std::cout << R"(Usage: mrtp_cli [OPTION]... FILE...
   Options:
+    -a, --antialias          adaptive anti-aliasing, samples per pixel: 1:16, 4:16, etc.
+    -A, --affinity           pin pool threads to CPUs: none (def.), compact, scatter
+    -b, --time-budget        stop rendering after seconds of wall time (def. 0, none)
+    -B, --backend            threading backend: openmp, pool (built-in)
+    -c, --aa-threshold       contrast between pixels that adds samples (def. 0.1)
+    -C, --texture-cache      directory of decoded textures, mapped instead of decoding PNG files
     -d, --light-distance     distance to darken light (def. 60)
+    -e, --stream-output      encode the PNG file while rendering, rows of tiles deflated in parallel
+    -E, --output-format      png, ppm, pfm (float), raw (float RGB rows, no header) (def. by extension, else png)
     -f, --fov                field of vision, in degrees (def. 93)
+    -F, --texture-filter     texture filtering: nearest (def.), bilinear, trilinear (mipmaps)
+    -g, --out-of-core        image not held in memory, rows written as done, up to 1048576x1048576 (no -a, -P, -w, -H)
     -h, --help               print this help screen
-    -o, --output-file        output filename in PNG format
+    -H, --heatmap            cost of tiles by time or tests: NAME_heat.png and NAME_tiles.csv (no -g)
+    -i, --preview-interval   seconds between preview images (def. 5)
+    -j, --stats-json         write phase times and ray statistics of all files to a JSON file
+    -k, --shadow-bias        depth bias of the shadow map (def. 0.05)
+    -L, --light-samples      lights shaded per hit in scenes with several lights (def. 8, max. 16)
+    -m, --shadow-map         shadow map of 16..2048 texels per face instead of shadow rays (def. 0, off)
+    -M, --texture-budget     megabytes of resident textures, least recently used evicted (def. 0, none)
+    -o, --output-file        output filename, in PNG format unless it ends in .ppm, .pfm or .raw
+    -O, --tile-order         order of tiles: scanline (def.), hilbert, spiral
+    -p, --packet-size        primary ray packets: 0 (auto, def.), 1 (off), 4, 8, 16
+    -P, --progressive        progressive rendering from blocks of 1 (off, def.), 2, 4, 8, etc.
     -q, --quiet              suppress all messages, except errors
     -r, --resolution         resolution: 640x480 (def.), 1024x768, etc.
     -R, --recursion-levels   levels of recursion for reflected rays (def. 3)
     -s, --shadow-factor      shadow factor (def. 0.25)
+    -S, --stats              report phase times and ray statistics
     -t, --threads            rendering threads: 0 (auto), 1 (def.), 2, 4, etc.
+    -T, --tile-size          size of tiles handed out to threads (def. 32)
+    -w, --preview-file       write preview images in PNG format while rendering
+    -W, --wavefront          staged renderer: off (def.), on, actor or direction (sorted)
+    -x, --texture-format     texel format: float (def.), rgb8, rgba8, bc1 (4x4 blocks)
+    -X, --texture-layout     texels in memory: linear (def.), tiled (8x8), morton
+    -Y, --trace              write a timeline of all threads as Chrome trace JSON (built with -DMRTP_TRACE)
+    -z, --lazy-textures      load textures on first use instead of before rendering
 
 Example:
   mrtp_cli -r 1620x1080 -f 110.0 -o scene2.png scene2.toml)" << std::endl;
@@ -74,19 +149,252 @@ int main(int argc, char **argv) {
     unsigned int height = kDefaultHeight;
     unsigned int recursion = kDefaultRecursionLevels;
     unsigned int threads = kDefaultThreads;
+    unsigned int packet = kDefaultPacketSize;
+    unsigned int tile_size = kDefaultTileSize;
+    mrtp::TileOrder_t tile_order = mrtp::to_scanline;
+    mrtp::ParallelBackend_t backend = mrtp::kDefaultBackend;
+    mrtp::PinMode_t affinity = mrtp::pm_none;
+    unsigned int min_samples = kDefaultMinSamples;
+    unsigned int max_samples = kDefaultMaxSamples;
+    float threshold = kDefaultThreshold;
+    unsigned int stride = kDefaultStride;
+    float preview_interval = kDefaultPreviewInterval;
+    float time_budget = kDefaultTimeBudget;
+    unsigned int map_size = kDefaultMapSize;
+    float map_bias = kDefaultMapBias;
+    unsigned int light_samples = kDefaultLightSamples;
+    mrtp::TextureFilter_t texture_filter = mrtp::tf_nearest;
+    mrtp::TexelFormat_t texture_format = mrtp::tx_float;
+    mrtp::TextureLayout_t texture_layout = mrtp::tl_linear;
+    std::string texture_cache;
+    bool lazy_textures = false;
+    bool stream_output = false;
+    int output_format = -1;
+    bool out_of_core = false;
+    mrtp::HeatMetric_t heatmap = mrtp::hm_none;
+    float texture_budget = 0.0f;
     float fov = kDefaultFOV;
     float distance = kDefaultDistance;
     float shadow = kDefaultShadow;
     bool quiet = false;
+    bool stats = false;
+    bool wavefront = false;
+    mrtp::RaySort_t ray_sort = mrtp::so_none;
 
     std::vector<std::string> toml_files;
     std::string png_file;
+    std::string preview_file;
+    std::string stats_json;
+    std::string trace_file;
     
     //Begin working on options
     for (int i = 1; i < argc; ++i) {
         std::string option(argv[i]);
 
-        if (option == "-d" || option == "--light-distance") {
+        if (option == "-a" || option == "--antialias") {
+            if (i + 1 >= argc) {
+                std::cerr << "anti-aliasing requires argument" << std::endl;
+                return exit_antialias;
+            }
+            std::string argument(argv[++i]);
+            size_t pos = argument.find(':');
+            if (pos == std::string::npos) {
+                std::cerr << "invalid format of anti-aliasing samples" << std::endl;
+                return exit_antialias;
+            }
+            std::stringstream convert(argument.substr(0, pos));
+            convert >> min_samples;
+            std::stringstream convert_other(argument.substr(pos + 1));
+            convert_other >> max_samples;
+            if (!convert || !convert_other) {
+                std::cerr << "error reading anti-aliasing samples" << std::endl;
+                return exit_antialias;
+            }
+            if (min_samples < 1 || min_samples > max_samples || max_samples > kMaxSamples) {
+                std::cerr << "out of range anti-aliasing samples" << std::endl;
+                return exit_antialias;
+            }
+            unsigned int min_root = static_cast<unsigned int>(std::lround(std::sqrt(min_samples)));
+            unsigned int max_root = static_cast<unsigned int>(std::lround(std::sqrt(max_samples)));
+            if (min_root * min_root != min_samples || max_root * max_root != max_samples) {
+                std::cerr << "anti-aliasing samples must be squares: 1, 4, 9, 16, etc." << std::endl;
+                return exit_antialias;
+            }
+
+        } else if (option == "-b" || option == "--time-budget") {
+            if (i + 1 >= argc) {
+                std::cerr << "time budget requires argument" << std::endl;
+                return exit_time_budget;
+            }
+            std::string argument(argv[++i]);
+            std::stringstream convert(argument);
+            convert >> time_budget;
+            if (!convert || time_budget < 0.0f) {
+                std::cerr << "error reading time budget" << std::endl;
+                return exit_time_budget;
+            }
+
+        } else if (option == "-c" || option == "--aa-threshold") {
+            if (i + 1 >= argc) {
+                std::cerr << "anti-aliasing threshold requires argument" << std::endl;
+                return exit_aa_threshold;
+            }
+            std::string argument(argv[++i]);
+            std::stringstream convert(argument);
+            convert >> threshold;
+            if (!convert || threshold < 0.0f) {
+                std::cerr << "error reading anti-aliasing threshold" << std::endl;
+                return exit_aa_threshold;
+            }
+
+        } else if (option == "-F" || option == "--texture-filter") {
+            if (i + 1 >= argc) {
+                std::cerr << "texture filter requires argument" << std::endl;
+                return exit_texture_filter;
+            }
+            std::string argument(argv[++i]);
+            if (argument == "nearest") { texture_filter = mrtp::tf_nearest; }
+            else if (argument == "bilinear") { texture_filter = mrtp::tf_bilinear; }
+            else if (argument == "trilinear") { texture_filter = mrtp::tf_trilinear; }
+            else {
+                std::cerr << "unknown texture filter: " << argument << std::endl;
+                return exit_texture_filter;
+            }
+
+        } else if (option == "-x" || option == "--texture-format") {
+            if (i + 1 >= argc) {
+                std::cerr << "texture format requires argument" << std::endl;
+                return exit_texture_format;
+            }
+            std::string argument(argv[++i]);
+            if (!mrtp::parse_texel_format(argument.c_str(), &texture_format)) {
+                std::cerr << "unknown texture format: " << argument << std::endl;
+                return exit_texture_format;
+            }
+
+        } else if (option == "-C" || option == "--texture-cache") {
+            if (i + 1 >= argc) {
+                std::cerr << "texture cache requires argument" << std::endl;
+                return exit_texture_cache;
+            }
+            texture_cache = argv[++i];
+
+        } else if (option == "-M" || option == "--texture-budget") {
+            if (i + 1 >= argc) {
+                std::cerr << "texture budget requires argument" << std::endl;
+                return exit_texture_budget;
+            }
+            std::string argument(argv[++i]);
+            std::stringstream convert(argument);
+            convert >> texture_budget;
+            if (!convert || texture_budget < 0.0f) {
+                std::cerr << "error reading texture budget" << std::endl;
+                return exit_texture_budget;
+            }
+
+        } else if (option == "-z" || option == "--lazy-textures") {
+            lazy_textures = true;
+
+        } else if (option == "-e" || option == "--stream-output") {
+            stream_output = true;
+
+        } else if (option == "-g" || option == "--out-of-core") {
+            out_of_core = true;
+
+        } else if (option == "-Y" || option == "--trace") {
+            if (i + 1 >= argc) {
+                std::cerr << "trace file requires argument" << std::endl;
+                return exit_trace;
+            }
+            trace_file = argv[++i];
+
+        } else if (option == "-H" || option == "--heatmap") {
+            if (i + 1 >= argc) {
+                std::cerr << "heatmap requires argument" << std::endl;
+                return exit_heatmap;
+            }
+            std::string argument(argv[++i]);
+            if (argument == "time") { heatmap = mrtp::hm_time; }
+            else if (argument == "tests") { heatmap = mrtp::hm_tests; }
+            else {
+                std::cerr << "unknown heatmap metric" << std::endl;
+                return exit_heatmap;
+            }
+
+        } else if (option == "-E" || option == "--output-format") {
+            if (i + 1 >= argc) {
+                std::cerr << "output format requires argument" << std::endl;
+                return exit_output_format;
+            }
+            std::string argument(argv[++i]);
+            if (argument == "png") { output_format = mrtp::of_png; }
+            else if (argument == "ppm") { output_format = mrtp::of_ppm; }
+            else if (argument == "pfm") { output_format = mrtp::of_pfm; }
+            else if (argument == "raw") { output_format = mrtp::of_raw; }
+            else {
+                std::cerr << "unknown output format" << std::endl;
+                return exit_output_format;
+            }
+
+        } else if (option == "-X" || option == "--texture-layout") {
+            if (i + 1 >= argc) {
+                std::cerr << "texture layout requires argument" << std::endl;
+                return exit_texture_layout;
+            }
+            std::string argument(argv[++i]);
+            if (!mrtp::parse_texture_layout(argument.c_str(), &texture_layout)) {
+                std::cerr << "unknown texture layout: " << argument << std::endl;
+                return exit_texture_layout;
+            }
+
+        } else if (option == "-k" || option == "--shadow-bias") {
+            if (i + 1 >= argc) {
+                std::cerr << "shadow bias requires argument" << std::endl;
+                return exit_shadow_bias;
+            }
+            std::string argument(argv[++i]);
+            std::stringstream convert(argument);
+            convert >> map_bias;
+            if (!convert || map_bias < 0.0f) {
+                std::cerr << "error reading shadow bias" << std::endl;
+                return exit_shadow_bias;
+            }
+
+        } else if (option == "-L" || option == "--light-samples") {
+            if (i + 1 >= argc) {
+                std::cerr << "light samples requires argument" << std::endl;
+                return exit_light_samples;
+            }
+            std::string argument(argv[++i]);
+            std::stringstream convert(argument);
+            convert >> light_samples;
+            if (!convert) {
+                std::cerr << "error reading light samples" << std::endl;
+                return exit_light_samples;
+            }
+            if (light_samples < kMinLightSamples || light_samples > kMaxLightSamples) {
+                std::cerr << "out of range light samples" << std::endl;
+                return exit_light_samples;
+            }
+
+        } else if (option == "-m" || option == "--shadow-map") {
+            if (i + 1 >= argc) {
+                std::cerr << "shadow map requires argument" << std::endl;
+                return exit_shadow_map;
+            }
+            std::string argument(argv[++i]);
+            std::stringstream convert(argument);
+            convert >> map_size;
+            if (!convert) {
+                std::cerr << "error reading shadow map size" << std::endl;
+                return exit_shadow_map;
+            }
+            if (map_size != 0 && (map_size < kMinMapSize || map_size > kMaxMapSize)) {
+                std::cerr << "out of range shadow map size" << std::endl;
+                return exit_shadow_map;
+            }
+
+        } else if (option == "-d" || option == "--light-distance") {
             if (i + 1 >= argc) {
                 std::cerr << "distance requires argument" << std::endl;
                 return exit_light_distance;
@@ -120,6 +428,19 @@ int main(int argc, char **argv) {
             help_message();
             return exit_ok;
 
+        } else if (option == "-i" || option == "--preview-interval") {
+            if (i + 1 >= argc) {
+                std::cerr << "preview interval requires argument" << std::endl;
+                return exit_preview_interval;
+            }
+            std::string argument(argv[++i]);
+            std::stringstream convert(argument);
+            convert >> preview_interval;
+            if (!convert || preview_interval < 0.0f) {
+                std::cerr << "error reading preview interval" << std::endl;
+                return exit_preview_interval;
+            }
+
         } else if (option == "-o" || option == "--output-file") {
             if (i + 1 >= argc) {
                 std::cerr << "output file requires argument" << std::endl;
@@ -128,6 +449,40 @@ int main(int argc, char **argv) {
             png_file = argv[++i];
             //TODO Check for a valid filename
 
+        } else if (option == "-p" || option == "--packet-size") {
+            if (i + 1 >= argc) {
+                std::cerr << "packet size requires argument" << std::endl;
+                return exit_packet_size;
+            }
+            std::string argument(argv[++i]);
+            std::stringstream convert(argument);
+            convert >> packet;
+            if (!convert) {
+                std::cerr << "error reading packet size" << std::endl;
+                return exit_packet_size;
+            }
+            if (packet != 0 && packet != 1 && packet != 4 && packet != 8 && packet != 16) {
+                std::cerr << "packet size must be 0, 1, 4, 8 or 16" << std::endl;
+                return exit_packet_size;
+            }
+
+        } else if (option == "-P" || option == "--progressive") {
+            if (i + 1 >= argc) {
+                std::cerr << "progressive requires argument" << std::endl;
+                return exit_progressive;
+            }
+            std::string argument(argv[++i]);
+            std::stringstream convert(argument);
+            convert >> stride;
+            if (!convert) {
+                std::cerr << "error reading progressive block size" << std::endl;
+                return exit_progressive;
+            }
+            if (stride < 1 || stride > kMaxStride || (stride & (stride - 1)) != 0) {
+                std::cerr << "progressive block size must be a power of 2, up to 64" << std::endl;
+                return exit_progressive;
+            }
+
         } else if (option == "-q" || option == "--quiet") {
             quiet = true;
 
@@ -169,7 +524,7 @@ int main(int argc, char **argv) {
                 std::cerr << "unable to convert width" << std::endl;
                 return exit_resolution;
             }
-            if (width < kMinWidth || width > kMaxWidth) {
+            if (width < kMinWidth || width > kMaxOutOfCore) {
                 std::cerr << "out of range width" << std::endl;
                 return exit_resolution;
             }
@@ -180,7 +535,7 @@ int main(int argc, char **argv) {
                 std::cerr << "unable to convert height" << std::endl;
                 return exit_resolution;
             }
-            if (height < kMinHeight || height > kMaxHeight) {
+            if (height < kMinHeight || height > kMaxOutOfCore) {
                 std::cerr << "out of range height" << std::endl;
                 return exit_resolution;
             }
@@ -198,6 +553,16 @@ int main(int argc, char **argv) {
                 return exit_shadow_factor;
             }
 
+        } else if (option == "-S" || option == "--stats") {
+            stats = true;
+
+        } else if (option == "-j" || option == "--stats-json") {
+            if (i + 1 >= argc) {
+                std::cerr << "statistics file requires argument" << std::endl;
+                return exit_stats_json;
+            }
+            stats_json = argv[++i];
+
         } else if (option == "-t" || option == "--threads") {
             if (i + 1 >= argc) {
                 std::cerr << "number of threads requires argument" << std::endl;
@@ -215,6 +580,92 @@ int main(int argc, char **argv) {
                 return exit_threads;
             }
 
+        } else if (option == "-W" || option == "--wavefront") {
+            if (i + 1 >= argc) {
+                std::cerr << "wavefront requires argument" << std::endl;
+                return exit_wavefront;
+            }
+            std::string argument(argv[++i]);
+            wavefront = (argument != "off");
+            if (argument == "off" || argument == "on") { ray_sort = mrtp::so_none; }
+            else if (argument == "actor") { ray_sort = mrtp::so_actor; }
+            else if (argument == "direction") { ray_sort = mrtp::so_direction; }
+            else {
+                std::cerr << "unknown wavefront mode: " << argument << std::endl;
+                return exit_wavefront;
+            }
+
+        } else if (option == "-w" || option == "--preview-file") {
+            if (i + 1 >= argc) {
+                std::cerr << "preview file requires argument" << std::endl;
+                return exit_preview_file;
+            }
+            preview_file = argv[++i];
+
+        } else if (option == "-T" || option == "--tile-size") {
+            if (i + 1 >= argc) {
+                std::cerr << "tile size requires argument" << std::endl;
+                return exit_tile_size;
+            }
+            std::string argument(argv[++i]);
+            std::stringstream convert(argument);
+            convert >> tile_size;
+            if (!convert) {
+                std::cerr << "error reading tile size" << std::endl;
+                return exit_tile_size;
+            }
+            if (tile_size < kMinTileSize || tile_size > kMaxTileSize) {
+                std::cerr << "out of range tile size" << std::endl;
+                return exit_tile_size;
+            }
+
+        } else if (option == "-O" || option == "--tile-order") {
+            if (i + 1 >= argc) {
+                std::cerr << "tile order requires argument" << std::endl;
+                return exit_tile_order;
+            }
+            std::string argument(argv[++i]);
+            if (argument == "scanline") { tile_order = mrtp::to_scanline; }
+            else if (argument == "hilbert") { tile_order = mrtp::to_hilbert; }
+            else if (argument == "spiral") { tile_order = mrtp::to_spiral; }
+            else {
+                std::cerr << "unknown tile order: " << argument << std::endl;
+                return exit_tile_order;
+            }
+
+        } else if (option == "-B" || option == "--backend") {
+            if (i + 1 >= argc) {
+                std::cerr << "backend requires argument" << std::endl;
+                return exit_backend;
+            }
+            std::string argument(argv[++i]);
+            if (argument == "openmp") { backend = mrtp::pb_openmp; }
+            else if (argument == "pool") { backend = mrtp::pb_pool; }
+            else {
+                std::cerr << "unknown backend: " << argument << std::endl;
+                return exit_backend;
+            }
+#ifndef _OPENMP
+            if (backend == mrtp::pb_openmp) {
+                std::cerr << "OpenMP not compiled in" << std::endl;
+                return exit_backend;
+            }
+#endif
+
+        } else if (option == "-A" || option == "--affinity") {
+            if (i + 1 >= argc) {
+                std::cerr << "affinity requires argument" << std::endl;
+                return exit_affinity;
+            }
+            std::string argument(argv[++i]);
+            if (argument == "none") { affinity = mrtp::pm_none; }
+            else if (argument == "compact") { affinity = mrtp::pm_compact; }
+            else if (argument == "scatter") { affinity = mrtp::pm_scatter; }
+            else {
+                std::cerr << "unknown affinity: " << argument << std::endl;
+                return exit_affinity;
+            }
+
         } else {
             if (option[0] == '-') {
                 std::cerr << "unrecognized option: " << option << std::endl;
@@ -226,11 +677,36 @@ int main(int argc, char **argv) {
     }
     //Finished working on options
 
+    //Larger images are only rendered out of core
+    if ((!out_of_core) && (width > kMaxWidth)) {
+        std::cerr << "out of range width" << std::endl;
+        return exit_resolution;
+    }
+    if ((!out_of_core) && (height > kMaxHeight)) {
+        std::cerr << "out of range height" << std::endl;
+        return exit_resolution;
+    }
+    if (out_of_core && ((max_samples > 1) || (stride > 1) || (preview_file != "") ||
+                        (heatmap != mrtp::hm_none))) {
+        std::cerr << "out-of-core rendering excludes anti-aliasing, progressive rendering, "
+                  << "previews and heatmaps" << std::endl;
+        return exit_out_of_core;
+    }
+
     if (toml_files.empty()) {
         std::cerr << "missing toml file" << std::endl;
         return exit_toml;
     }
 
+#ifdef MRTP_TRACE
+    if (trace_file != "") { mrtp::tracer.start(); }
+#else
+    if (trace_file != "") {
+        std::cerr << "tracing is not compiled in, build with -DMRTP_TRACE" << std::endl;
+        return exit_trace;
+    }
+#endif
+
     bool use_auto_name = (toml_files.size() > 1) || (png_file == "");
     if (use_auto_name) {
         if (png_file != "") {
@@ -239,16 +715,39 @@ int main(int argc, char **argv) {
         }
     }
 
+    //Textures are shared by all files, so is their filtering, format and layout
+    mrtp::textureCollector.set_filter(texture_filter);
+    mrtp::textureCollector.set_format(texture_format);
+    mrtp::textureCollector.set_layout(texture_layout);
+    mrtp::textureCollector.set_cache(texture_cache.c_str());
+    mrtp::textureCollector.set_lazy(lazy_textures);
+    mrtp::textureCollector.set_threads(threads);
+    mrtp::textureCollector.set_budget(static_cast<size_t>(texture_budget * 1.0e6f));
+
+    //Pool threads are started once and reused for all files
+    if (backend == mrtp::pb_pool && threads != 1) {
+        mrtp::threadPool.start(threads, affinity);
+    }
+
     std::vector<std::string>::iterator iter = toml_files.begin();
     std::vector<std::string>::iterator iter_end = toml_files.end();
+    std::vector<mrtp::Profile> profiles;
 
     //Iterate over all input files
     for (; iter != iter_end; ++iter) {
         std::string toml_file = *iter;
+        MRTP_TRACE_SCOPE_TEXT("scene", iter->c_str());
         if (!quiet) { std::cout << "processing " << toml_file << std::flush; }
 
+        //Textures are decoded in initialize, or while rendering if lazy
+        mrtp::Profile profile(toml_file.c_str());
+        float texture_start = mrtp::textureCollector.get_load_time();
+        std::chrono::steady_clock::time_point phase_start = std::chrono::steady_clock::now();
+
         mrtp::World world(toml_file.c_str());
         mrtp::WorldStatus_t status = world.initialize();
+        float init_time = seconds_since(phase_start);
+        float init_textures = mrtp::textureCollector.get_load_time() - texture_start;
         if (status != mrtp::ws_ok) {
             if (!quiet) { std::cout << std::endl; }
 
@@ -273,20 +772,111 @@ int main(int argc, char **argv) {
             std::string foo(toml_file);
             size_t pos = toml_file.rfind(".toml");
             if (pos != std::string::npos) { foo = toml_file.substr(0, pos); }
-            png_file = foo + ".png";
+            png_file = foo + kOutputExtensions[(output_format < 0) ? mrtp::of_png : output_format];
+        }
+
+        //Without -E, the format follows the extension
+        mrtp::OutputFormat_t format = mrtp::of_png;
+        if (output_format >= 0) {
+            format = static_cast<mrtp::OutputFormat_t>(output_format);
+        } else {
+            size_t pos = png_file.rfind('.');
+            std::string extension = (pos != std::string::npos) ? png_file.substr(pos) : "";
+            for (int k = 0; k < kOutputFormats; k++) {
+                if (extension == kOutputExtensions[k]) {
+                    format = static_cast<mrtp::OutputFormat_t>(k);
+                }
+            }
         }
 
         mrtp::Renderer renderer(&world, width, height, fov, distance, shadow, kDefaultBias, 
                                 recursion, threads, png_file.c_str());
+        renderer.set_packet_size(packet);
+        renderer.set_tiles(tile_size, tile_order);
+        renderer.set_backend(backend);
+        renderer.set_antialias(min_samples, max_samples, threshold);
+        renderer.set_progressive(stride);
+        renderer.set_preview(preview_file.c_str(), preview_interval);
+        renderer.set_time_budget(time_budget);
+        renderer.set_stats(stats || (!stats_json.empty()));
+        renderer.set_wavefront(wavefront, ray_sort);
+        renderer.set_shadow_map(map_size, map_bias);
+        renderer.set_light_samples(light_samples);
+        renderer.set_streaming(stream_output && (format == mrtp::of_png));
+        renderer.set_output_format(format);
+        renderer.set_out_of_core(out_of_core);
+        renderer.set_heatmap(heatmap);
 
         float time_used = renderer.render_scene();
-        if (!quiet) { std::cout << " (render time: " << std::setprecision(2) << time_used << "s)" << std::endl; }
-
+        if (!quiet) {
+            std::cout << " (render time: " << std::setprecision(2) << time_used << "s)";
+            if (renderer.budget_expired()) { std::cout << " (stopped on time budget)"; }
+            std::cout << std::endl;
+        }
+        phase_start = std::chrono::steady_clock::now();
         if (renderer.write_scene() != mrtp::rs_ok) {
             std::cerr << "error writing scene" << std::endl;
             return exit_write_scene;
         }
+        profile.set_phase(mrtp::pp_parse, init_time - init_textures);
+        profile.set_phase(mrtp::pp_textures, mrtp::textureCollector.get_load_time() - texture_start);
+        profile.set_phase(mrtp::pp_render, time_used);
+        profile.set_phase(mrtp::pp_write, seconds_since(phase_start));
+        renderer.get_profile(&profile);
+
+        //Costs of tiles are written next to the output, as NAME_heat.png and NAME_tiles.csv
+        if (heatmap != mrtp::hm_none) {
+            size_t pos = png_file.rfind('.');
+            std::string base = (pos != std::string::npos) ? png_file.substr(0, pos) : png_file;
+            std::string heat_png = base + "_heat.png";
+            std::string tiles_csv = base + "_tiles.csv";
+            if (renderer.write_heatmap(heat_png.c_str(), tiles_csv.c_str()) != mrtp::rs_ok) {
+                std::cerr << "error writing heatmap" << std::endl;
+                return exit_heatmap;
+            }
+        }
+
+        if (stats) {
+            profile.print();
+            long long shadow_rays = renderer.get_shadow_rays();
+            float shadow_time = renderer.get_shadow_time();
+            float rate = (shadow_time > 0.0f) ? 1.0e-6f * shadow_rays / shadow_time : 0.0f;
+            std::cout << "  shadow rays: " << shadow_rays << " in " << std::setprecision(3) 
+                      << shadow_time << "s (" << rate << " Mrays/s per thread)" << std::endl;
+            std::cout << "  textures: " << mrtp::textureCollector.get_loaded() << " of "
+                      << mrtp::textureCollector.get_count() << " loaded (" << std::setprecision(3)
+                      << 1.0e-6f * mrtp::textureCollector.get_memory() << " MB) in "
+                      << mrtp::textureCollector.get_load_time() << "s"
+                      << std::endl;
+            if (mrtp::textureCollector.has_budget()) {
+                std::cout << "  texture residency: " << mrtp::textureCollector.get_hits()
+                          << " hits, " << mrtp::textureCollector.get_misses() << " misses, "
+                          << mrtp::textureCollector.get_evictions() << " evictions, peak "
+                          << 1.0e-6f * mrtp::textureCollector.get_peak() << " MB" << std::endl;
+            }
+        }
+
+        if (stats && stream_output && (format == mrtp::of_png)) {
+            std::cout << "  streamed output: " << renderer.get_streamed_bands() 
+                      << " bands encoded while rendering" << std::endl;
+        }
+
+        //Rewritten after each file, so that finished files are kept on errors
+        if (!stats_json.empty()) {
+            profiles.push_back(profile);
+            if (!mrtp::write_profiles(stats_json.c_str(), &profiles)) {
+                std::cerr << "error writing statistics file" << std::endl;
+                return exit_stats_json;
+            }
+        }
+    }
+
+#ifdef MRTP_TRACE
+    if ((trace_file != "") && (!mrtp::tracer.write(trace_file.c_str()))) {
+        std::cerr << "error writing trace file" << std::endl;
+        return exit_trace;
     }
+#endif
     
     return exit_ok;
 }
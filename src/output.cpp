@@ -0,0 +1,247 @@
+/* File      : output.cpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "renderer.hpp"
+
+
+namespace mrtp {
+
+static const float kRealToByte = 255.0f;
+
+static_assert(sizeof(Pixel) == 3 * sizeof(float), "pixels are written as packed floats");
+
+/*
+A negative scale marks little endian floats in PFM.
+*/
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+static const char *kPfmScale = "1.0";
+#else
+static const char *kPfmScale = "-1.0";
+#endif
+
+#ifdef IOV_MAX
+static const int kMaxVectors = IOV_MAX;
+#else
+static const int kMaxVectors = 1024;
+#endif
+
+/*
+Writes all pieces in order, picking up after short
+writes. Pieces are consumed on the way.
+*/
+static bool write_vectors(int fd, struct iovec *pieces, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, pieces, std::min(count, kMaxVectors));
+        if (written < 0) { return false; }
+
+        size_t left = static_cast<size_t>(written);
+        while ((count > 0) && (left >= pieces->iov_len)) {
+            left -= pieces->iov_len;
+            pieces++;
+            count--;
+        }
+        if (count > 0) {
+            pieces->iov_base = static_cast<char *>(pieces->iov_base) + left;
+            pieces->iov_len -= left;
+        }
+    }
+    return true;
+}
+
+/*
+Writes data at an offset of the file, picking up after
+short writes. Safe to call from several threads.
+*/
+static bool write_at(int fd, const void *data, size_t size, size_t offset) {
+    const char *bytes = static_cast<const char *>(data);
+
+    while (size > 0) {
+        ssize_t written = pwrite(fd, bytes, size, offset);
+        if (written <= 0) { return false; }
+        bytes += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+static int create_file(const char *path, int flags) {
+    return open(path, flags | O_CREAT | O_TRUNC, 0644);
+}
+
+static std::string ppm_header(int width, int height) {
+    return "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+}
+
+static std::string pfm_header(int width, int height) {
+    return "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n" +
+           kPfmScale + "\n";
+}
+
+/*
+Quantizes pixels to 8-bit RGB, as in write_png.
+*/
+static void quantize(const Pixel *in, size_t count, unsigned char *out) {
+    for (size_t k = 0; k < count; k++, in++, out += 3) {
+        Pixel bytes = kRealToByte * (*in);
+        out[0] = static_cast<unsigned char>(bytes[0]);
+        out[1] = static_cast<unsigned char>(bytes[1]);
+        out[2] = static_cast<unsigned char>(bytes[2]);
+    }
+}
+
+/*
+Binary PPM of 8-bit RGB. The file is mapped and pixels
+are quantized right into it, as in write_png.
+*/
+bool Renderer::write_ppm(const char *path) {
+    std::string header = ppm_header(width_, height_);
+    size_t size = header.size() + 3 * static_cast<size_t>(width_) * height_;
+
+    int fd = create_file(path, O_RDWR);
+    if (fd < 0) { return rs_fail; }
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        return rs_fail;
+    }
+    void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        close(fd);
+        return rs_fail;
+    }
+
+    unsigned char *out = static_cast<unsigned char *>(mapping);
+    std::memcpy(out, header.data(), header.size());
+    quantize(framebuffer_, static_cast<size_t>(width_) * height_, out + header.size());
+
+    bool ok = munmap(mapping, size) == 0;
+    ok = (close(fd) == 0) && ok;
+    return (ok) ? rs_ok : rs_fail;
+}
+
+/*
+PFM of float RGB, unclamped. PFM stores rows from the
+bottom up, so rows of the frame buffer are gathered in
+reverse into one vectored write, without copies.
+*/
+bool Renderer::write_pfm(const char *path) {
+    std::string header = pfm_header(width_, height_);
+
+    std::vector<struct iovec> pieces(height_ + 1);
+    pieces[0].iov_base = const_cast<char *>(header.data());
+    pieces[0].iov_len = header.size();
+    for (int j = 0; j < height_; j++) {
+        pieces[j + 1].iov_base = &framebuffer_[static_cast<size_t>(height_ - 1 - j) * width_];
+        pieces[j + 1].iov_len = width_ * sizeof(Pixel);
+    }
+
+    int fd = create_file(path, O_WRONLY);
+    if (fd < 0) { return rs_fail; }
+    bool ok = write_vectors(fd, &pieces[0], static_cast<int>(pieces.size()));
+    ok = (close(fd) == 0) && ok;
+    return (ok) ? rs_ok : rs_fail;
+}
+
+/*
+The frame buffer as it is in memory: float RGB, rows
+from the top down, no header.
+*/
+bool Renderer::write_raw(const char *path) {
+    struct iovec piece;
+    piece.iov_base = framebuffer_;
+    piece.iov_len = static_cast<size_t>(width_) * height_ * sizeof(Pixel);
+
+    int fd = create_file(path, O_WRONLY);
+    if (fd < 0) { return rs_fail; }
+    bool ok = write_vectors(fd, &piece, 1);
+    ok = (close(fd) == 0) && ok;
+    return (ok) ? rs_ok : rs_fail;
+}
+
+/*
+Creates the output file in its final size, so that bands
+can be written to their place in it in any order, as
+they are finished.
+*/
+bool Renderer::open_output() {
+    std::string header;
+    size_t pixelsize = sizeof(Pixel);
+    if (format_ == of_ppm) {
+        header = ppm_header(width_, height_);
+        pixelsize = 3;
+    } else if (format_ == of_pfm) {
+        header = pfm_header(width_, height_);
+    }
+    headersize_ = header.size();
+
+    output_ = create_file(path_, O_WRONLY);
+    outputfailed_ = output_ < 0;
+    if (outputfailed_) { return false; }
+
+    size_t size = headersize_ + pixelsize * width_ * height_;
+    if ((ftruncate(output_, size) != 0) ||
+        (!write_at(output_, header.data(), header.size(), 0))) {
+        outputfailed_ = true;
+    }
+    return !outputfailed_;
+}
+
+/*
+Writes rows of a band to the output file, PFM rows one
+by one, since they are stored from the bottom up. Called
+by any render thread, so a failure is only recorded in
+the atomic flag, and reported once by close_output.
+*/
+void Renderer::write_band(int band) {
+    if (output_ < 0) { return; }
+
+    size_t firstrow = static_cast<size_t>(band) * tilesize_;
+    int nrows = std::min(tilesize_, height_ - band * tilesize_);
+    size_t npixels = static_cast<size_t>(nrows) * width_;
+    size_t rowsize = width_ * sizeof(Pixel);
+    const Pixel *pixels = &framebuffer_[firstrow * width_];
+    bool ok = true;
+
+    if (format_ == of_ppm) {
+        std::vector<unsigned char> bytes(3 * npixels);
+        quantize(pixels, npixels, &bytes[0]);
+        ok = write_at(output_, &bytes[0], bytes.size(), headersize_ + 3 * firstrow * width_);
+    } else if (format_ == of_pfm) {
+        for (int j = 0; j < nrows; j++) {
+            size_t offset = headersize_ + (height_ - 1 - firstrow - j) * rowsize;
+            ok = ok && write_at(output_, &pixels[static_cast<size_t>(j) * width_], rowsize, offset);
+        }
+    } else {
+        ok = write_at(output_, pixels, npixels * sizeof(Pixel), firstrow * rowsize);
+    }
+    if (!ok) { outputfailed_ = true; }
+}
+
+/*
+Writes bands left over, e.g. when the time budget ran
+out, and closes the output file.
+*/
+bool Renderer::close_output() {
+    if (output_ < 0) { return rs_fail; }
+
+    for (size_t band = 0; band < bandtiles_.size(); band++) {
+        if (bandtiles_[band] > 0) { write_band(static_cast<int>(band)); }
+    }
+    bool ok = !outputfailed_;
+    ok = (close(output_) == 0) && ok;
+    output_ = -1;
+    return (ok) ? rs_ok : rs_fail;
+}
+
+} //namespace mrtp
@@ -0,0 +1,302 @@
+/* File      : packet.cpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#include <cmath>
+#include <limits>
+
+#include "packet.hpp"
+#include "primitives.hpp"
+
+/*
+Lane loops are compiled for several instruction sets and
+the best one is picked at load time. Packet width follows
+the vector width: 4 lanes (SSE), 8 (AVX2), 16 (AVX-512).
+On 4 lane packets, avx512f code is slower than single
+rays, so they are built for AVX2 at most.
+*/
+#if defined(__x86_64__) && defined(__GNUC__)
+#define PACKET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#define NARROW_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define PACKET_CLONES
+#define NARROW_CLONES
+#endif
+
+#define LANES_INLINE inline __attribute__((always_inline))
+
+
+namespace mrtp {
+
+int detect_packet_size() {
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) { return 16; }
+    if (__builtin_cpu_supports("avx2")) { return 8; }
+#endif
+    return 4;
+}
+
+/*
+Packets cover square or nearly square blocks of pixels
+to keep rays coherent.
+*/
+void packet_shape(int size, int *width, int *height) {
+    if (size >= 16) {
+        *width = 4;
+        *height = 4;
+    } else if (size >= 8) {
+        *width = 4;
+        *height = 2;
+    } else {
+        *width = 2;
+        *height = 2;
+    }
+}
+
+void packet_prepare(RayPacket *packet) {
+    for (int i = 0; i < packet->size; i++) {
+        packet->ix[i] = 1.0f / packet->dx[i];
+        packet->iy[i] = 1.0f / packet->dy[i];
+        packet->iz[i] = 1.0f / packet->dz[i];
+    }
+}
+
+/*
+Lane version of Actor::solve_quadratic, kept branch-free
+so that it vectorizes.
+*/
+static LANES_INLINE float lane_quadratic(float a, float b, float c, float maxt) {
+    float delta = b * b - 4.0f * a * c;
+    float sqdelta = std::sqrt((delta > 0.0f) ? delta : 0.0f);
+    float tmp = 0.5f / a;
+    float ta = (-b - sqdelta) * tmp;
+    float tb = (-b + sqdelta) * tmp;
+    float t = (ta < tb) ? ta : tb;
+    t = (delta > 0.0f) ? t : (-b / (2.0f * a));
+    t = ((t < 0.0f) | (t > maxt)) ? -1.0f : t;
+    return (delta >= 0.0f) ? t : -1.0f;
+}
+
+/*
+Same order of summation as Eigen's dot() for Vector3f,
+so packets give the same distances as single rays.
+*/
+static LANES_INLINE float lane_dot(float ax, float ay, float az, float bx, float by, float bz) {
+    return ax * bx + (ay * by + az * bz);
+}
+
+static LANES_INLINE float lane_min(float a, float b) { return (a < b) ? a : b; }
+
+static LANES_INLINE float lane_max(float a, float b) { return (a > b) ? a : b; }
+
+static LANES_INLINE void lane_update(RayPacket *packet, int i, float t, Actor *actor) {
+    int take = packet->active[i] & (t > 0.0f) & (t < packet->currd[i]);
+    packet->currd[i] = (take) ? t : packet->currd[i];
+    packet->hit[i] = (take) ? actor : packet->hit[i];
+}
+
+template <int N>
+static LANES_INLINE bool hit_box_lanes(RayPacket *packet, const float *lower,
+                                       const float *upper, float *entry) {
+    int any = 0;
+    float nearest = std::numeric_limits<float>::max();
+
+#pragma omp simd reduction(|:any) reduction(min:nearest)
+    for (int i = 0; i < N; i++) {
+        float ax = (lower[0] - packet->ox[i]) * packet->ix[i];
+        float bx = (upper[0] - packet->ox[i]) * packet->ix[i];
+        float ay = (lower[1] - packet->oy[i]) * packet->iy[i];
+        float by = (upper[1] - packet->oy[i]) * packet->iy[i];
+        float az = (lower[2] - packet->oz[i]) * packet->iz[i];
+        float bz = (upper[2] - packet->oz[i]) * packet->iz[i];
+
+        float tmin = lane_max(lane_max(lane_min(ax, bx), lane_min(ay, by)),
+                              lane_max(lane_min(az, bz), 0.0f));
+        float tmax = lane_min(lane_min(lane_max(ax, bx), lane_max(ay, by)),
+                              lane_min(lane_max(az, bz), packet->currd[i]));
+        int hit = packet->active[i] & (tmin <= tmax);
+        any |= hit;
+        nearest = lane_min(nearest, (hit) ? tmin : nearest);
+    }
+    *entry = nearest;
+    return any != 0;
+}
+
+/*
+Primitives are scanned in the outer loop and lanes in the
+inner one, so each primitive is loaded once per packet.
+With occluders set, only shadow casting primitives count.
+*/
+template <int N>
+static LANES_INLINE void solve_planes_lanes(RayPacket *packet, PlaneArray *planes,
+                                            int first, int last, bool occluders) {
+    for (int j = first; j < last; j++) {
+        if (occluders && !planes->shadow[j]) { continue; }
+
+        float cx = planes->cx[j], cy = planes->cy[j], cz = planes->cz[j];
+        float nx = planes->nx[j], ny = planes->ny[j], nz = planes->nz[j];
+        Actor *actor = planes->actors[j];
+
+#pragma omp simd
+        for (int i = 0; i < N; i++) {
+            float bar = lane_dot(packet->dx[i], packet->dy[i], packet->dz[i], nx, ny, nz);
+            float tx = packet->ox[i] - cx;
+            float ty = packet->oy[i] - cy;
+            float tz = packet->oz[i] - cz;
+            float d = -lane_dot(tx, ty, tz, nx, ny, nz) / bar;
+            int valid = (bar != 0.0f) & (d >= 0.0f) & (d <= packet->maxd[i]);
+            lane_update(packet, i, (valid) ? d : -1.0f, actor);
+        }
+    }
+}
+
+template <int N>
+static LANES_INLINE void solve_spheres_lanes(RayPacket *packet, SphereArray *spheres,
+                                             int first, int last, bool occluders) {
+    for (int j = first; j < last; j++) {
+        if (occluders && !spheres->shadow[j]) { continue; }
+
+        float cx = spheres->cx[j], cy = spheres->cy[j], cz = spheres->cz[j];
+        float radius = spheres->radius[j];
+        Actor *actor = spheres->actors[j];
+
+#pragma omp simd
+        for (int i = 0; i < N; i++) {
+            float tx = packet->ox[i] - cx;
+            float ty = packet->oy[i] - cy;
+            float tz = packet->oz[i] - cz;
+            float a = lane_dot(packet->dx[i], packet->dy[i], packet->dz[i], packet->dx[i], packet->dy[i], packet->dz[i]);
+            float b = 2.0f * lane_dot(packet->dx[i], packet->dy[i], packet->dz[i], tx, ty, tz);
+            float c = lane_dot(tx, ty, tz, tx, ty, tz) - (radius * radius);
+            lane_update(packet, i, lane_quadratic(a, b, c, packet->maxd[i]), actor);
+        }
+    }
+}
+
+template <int N>
+static LANES_INLINE void solve_cylinders_lanes(RayPacket *packet, CylinderArray *cylinders,
+                                               int first, int last, bool occluders) {
+    for (int j = first; j < last; j++) {
+        if (occluders && !cylinders->shadow[j]) { continue; }
+
+        float cx = cylinders->cx[j], cy = cylinders->cy[j], cz = cylinders->cz[j];
+        float ax = cylinders->ax[j], ay = cylinders->ay[j], az = cylinders->az[j];
+        float radius = cylinders->radius[j];
+        Actor *actor = cylinders->actors[j];
+
+        // Infinite cylinders have a non-positive span
+        float span = cylinders->span[j];
+        float limit = (span > 0.0f) ? span : std::numeric_limits<float>::max();
+
+#pragma omp simd
+        for (int i = 0; i < N; i++) {
+            float tx = packet->ox[i] - cx;
+            float ty = packet->oy[i] - cy;
+            float tz = packet->oz[i] - cz;
+
+            float a = lane_dot(packet->dx[i], packet->dy[i], packet->dz[i], tx, ty, tz);
+            float b = lane_dot(packet->dx[i], packet->dy[i], packet->dz[i], ax, ay, az);
+            float d = lane_dot(tx, ty, tz, ax, ay, az);
+            float f = (radius * radius) - lane_dot(tx, ty, tz, tx, ty, tz);
+
+            float aa = 1.0f - (b * b);
+            float bb = 2.0f * (a - b * d);
+            float cc = -(d * d) - f;
+            float t = lane_quadratic(aa, bb, cc, packet->maxd[i]);
+
+            // Check if the cylinder is finite, misses are rejected anyway
+            float alpha = d + t * b;
+            int outside = (alpha < -limit) | (alpha > limit);
+            lane_update(packet, i, (outside) ? -1.0f : t, actor);
+        }
+    }
+}
+
+/*
+Kernels for 4 lanes are kept apart from wider ones, so
+that they are not built for AVX-512.
+*/
+NARROW_CLONES
+static bool narrow_hit_box(RayPacket *packet, const float *lower, const float *upper,
+                           float *entry) {
+    return hit_box_lanes<4>(packet, lower, upper, entry);
+}
+
+PACKET_CLONES
+static bool wide_hit_box(RayPacket *packet, const float *lower, const float *upper,
+                         float *entry) {
+    if (packet->size == 8) { return hit_box_lanes<8>(packet, lower, upper, entry); }
+    return hit_box_lanes<16>(packet, lower, upper, entry);
+}
+
+NARROW_CLONES
+static void narrow_solve_planes(RayPacket *packet, PlaneArray *planes, int first, int last,
+                                bool occluders) {
+    solve_planes_lanes<4>(packet, planes, first, last, occluders);
+}
+
+PACKET_CLONES
+static void wide_solve_planes(RayPacket *packet, PlaneArray *planes, int first, int last,
+                              bool occluders) {
+    if (packet->size == 8) { solve_planes_lanes<8>(packet, planes, first, last, occluders); }
+    else { solve_planes_lanes<16>(packet, planes, first, last, occluders); }
+}
+
+NARROW_CLONES
+static void narrow_solve_spheres(RayPacket *packet, SphereArray *spheres, int first,
+                                 int last, bool occluders) {
+    solve_spheres_lanes<4>(packet, spheres, first, last, occluders);
+}
+
+PACKET_CLONES
+static void wide_solve_spheres(RayPacket *packet, SphereArray *spheres, int first,
+                               int last, bool occluders) {
+    if (packet->size == 8) { solve_spheres_lanes<8>(packet, spheres, first, last, occluders); }
+    else { solve_spheres_lanes<16>(packet, spheres, first, last, occluders); }
+}
+
+NARROW_CLONES
+static void narrow_solve_cylinders(RayPacket *packet, CylinderArray *cylinders, int first,
+                                   int last, bool occluders) {
+    solve_cylinders_lanes<4>(packet, cylinders, first, last, occluders);
+}
+
+PACKET_CLONES
+static void wide_solve_cylinders(RayPacket *packet, CylinderArray *cylinders, int first,
+                                 int last, bool occluders) {
+    if (packet->size == 8) { solve_cylinders_lanes<8>(packet, cylinders, first, last, occluders); }
+    else { solve_cylinders_lanes<16>(packet, cylinders, first, last, occluders); }
+}
+
+/*
+Returns true if any active lane enters the box before
+its current hit distance. On output, entry is the
+smallest entry distance among those lanes.
+*/
+bool packet_hit_box(RayPacket *packet, const float *lower, const float *upper,
+                    float *entry) {
+    if (packet->size == 4) { return narrow_hit_box(packet, lower, upper, entry); }
+    return wide_hit_box(packet, lower, upper, entry);
+}
+
+void packet_solve_planes(RayPacket *packet, PlaneArray *planes, int first, int last,
+                         bool occluders) {
+    if (packet->size == 4) { narrow_solve_planes(packet, planes, first, last, occluders); }
+    else { wide_solve_planes(packet, planes, first, last, occluders); }
+}
+
+void packet_solve_spheres(RayPacket *packet, SphereArray *spheres, int first, int last,
+                          bool occluders) {
+    if (packet->size == 4) { narrow_solve_spheres(packet, spheres, first, last, occluders); }
+    else { wide_solve_spheres(packet, spheres, first, last, occluders); }
+}
+
+void packet_solve_cylinders(RayPacket *packet, CylinderArray *cylinders, int first,
+                            int last, bool occluders) {
+    if (packet->size == 4) { narrow_solve_cylinders(packet, cylinders, first, last, occluders); }
+    else { wide_solve_cylinders(packet, cylinders, first, last, occluders); }
+}
+
+} //namespace mrtp
@@ -11,11 +11,12 @@
 namespace mrtp {
 
 Plane::Plane(Eigen::Vector3f *center, Eigen::Vector3f *normal, float scale, 
-             float reflect, const char *texture) {
+             float reflect, const char *texture, TexelFormat_t format) {
     center_ = *center;
     normal_ = (1.0f / normal->norm()) * (*normal);
     scale_ = scale;
     reflect_ = reflect;
+    type_ = at_plane;
     has_shadow_ = false;
 
     Eigen::Vector3f tmp = generate_unit_vector(&normal_);
@@ -24,17 +25,20 @@ Plane::Plane(Eigen::Vector3f *center, Eigen::Vector3f *normal, float scale,
     ty_ = normal_.cross(tx_);
     ty_ *= (1.0f / ty_.norm());
 
-    texture_ = textureCollector.add(texture);
+    texture_ = textureCollector.add(texture, format);
 }
 
 Plane::~Plane() {}
 
-Pixel Plane::pick_pixel(Eigen::Vector3f *hit, Eigen::Vector3f *normal) {
+Pixel Plane::pick_pixel(Eigen::Vector3f *hit, Eigen::Vector3f *normal, float footprint) {
     Eigen::Vector3f v = (*hit) - center_;
     // Calculate components of v (dot products)
     float vx = v.dot(tx_);
     float vy = v.dot(ty_);
 
+    if (footprint > 0.0f) {
+        return texture_->filter_pixel(vx, vy, scale_, footprint, footprint);
+    }
     return texture_->pick_pixel(vx, vy, scale_);
 }
 
@@ -52,6 +56,12 @@ float Plane::solve(Eigen::Vector3f *origin, Eigen::Vector3f *direction, float mi
     return -1.0f;
 }
 
+Eigen::Vector3f Plane::get_center() { return center_; }
+
+Eigen::Vector3f Plane::get_normal() { return normal_; }
+
 Eigen::Vector3f Plane::calculate_normal(Eigen::Vector3f *hit) { return normal_; }
 
+bool Plane::calculate_bounds(Eigen::Vector3f *, Eigen::Vector3f *) { return false; }
+
 } //namespace mrtp
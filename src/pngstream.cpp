@@ -0,0 +1,295 @@
+/* File      : pngstream.cpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#include <zlib.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "pngstream.hpp"
+#include "trace.hpp"
+
+
+namespace mrtp {
+
+static const float kRealToByte = 255.0f;
+static const int kChannels = 3;
+static const int kWindowBits = 15;
+static const int kMemoryLevel = 8;
+
+// Room for the marker of a flush, on top of deflateBound
+static const size_t kFlushMargin = 64;
+
+static const unsigned char kSignature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+
+// Zlib header of a 32K window and default compression
+static const unsigned char kZlibHeader[2] = {0x78, 0x9c};
+
+enum RowFilter_t {rf_none, rf_sub, rf_up, rf_average, rf_paeth};
+
+
+static void put_u32(unsigned char *out, unsigned long value) {
+    out[0] = static_cast<unsigned char>((value >> 24) & 0xff);
+    out[1] = static_cast<unsigned char>((value >> 16) & 0xff);
+    out[2] = static_cast<unsigned char>((value >> 8) & 0xff);
+    out[3] = static_cast<unsigned char>(value & 0xff);
+}
+
+static inline int paeth(int left, int up, int corner) {
+    int p = left + up - corner;
+    int pleft = std::abs(p - left);
+    int pup = std::abs(p - up);
+    int pcorner = std::abs(p - corner);
+    if ((pleft <= pup) && (pleft <= pcorner)) { return left; }
+    return (pup <= pcorner) ? up : corner;
+}
+
+/*
+Filters a row of size bytes into out, which starts with
+the type of filter. Prior is the row above, or nullptr
+for the first row of a band, whose row above may not be
+rendered yet. Returns the sum of filtered bytes taken as
+signed, lower sums usually deflate better.
+*/
+static unsigned long filter_row(RowFilter_t filter, const unsigned char *row,
+                                const unsigned char *prior, int size,
+                                unsigned char *out) {
+    out[0] = static_cast<unsigned char>(filter);
+    out++;
+
+    switch (filter) {
+        case rf_sub:
+            for (int k = 0; k < kChannels; k++) { out[k] = row[k]; }
+            for (int k = kChannels; k < size; k++) {
+                out[k] = static_cast<unsigned char>(row[k] - row[k - kChannels]);
+            }
+            break;
+        case rf_up:
+            for (int k = 0; k < size; k++) {
+                out[k] = static_cast<unsigned char>(row[k] - prior[k]);
+            }
+            break;
+        case rf_paeth:
+            for (int k = 0; k < kChannels; k++) {
+                out[k] = static_cast<unsigned char>(row[k] - prior[k]);
+            }
+            for (int k = kChannels; k < size; k++) {
+                int predicted = paeth(row[k - kChannels], prior[k], prior[k - kChannels]);
+                out[k] = static_cast<unsigned char>(row[k] - predicted);
+            }
+            break;
+        default:
+            std::memcpy(out, row, size);
+            break;
+    }
+
+    unsigned long cost = 0;
+    for (int k = 0; k < size; k++) {
+        cost += static_cast<unsigned long>(std::abs(static_cast<signed char>(out[k])));
+    }
+    return cost;
+}
+
+PngStream::PngStream() : file_(nullptr), width_(0), height_(0), bandrows_(1), nbands_(0),
+    nextband_(0), nstreamed_(0), failed_(false), adler_(1) {}
+
+PngStream::~PngStream() {
+    if (file_) { std::fclose(file_); }
+}
+
+/*
+Creates the file and writes the header of the image,
+bands hold bandrows rows each, but the last.
+*/
+bool PngStream::open(const char *path, int width, int height, int bandrows) {
+    width_ = width;
+    height_ = height;
+    bandrows_ = bandrows;
+    nbands_ = (height + bandrows - 1) / bandrows;
+    nextband_ = 0;
+    nstreamed_ = 0;
+    adler_ = adler32(0L, nullptr, 0);
+
+    deflated_.assign(nbands_, std::vector<unsigned char>());
+    adlers_.assign(nbands_, 0);
+    lengths_.assign(nbands_, 0);
+    encoded_.assign(nbands_, 0);
+
+    file_ = std::fopen(path, "wb");
+    failed_ = (file_ == nullptr);
+    if (failed_) { return false; }
+
+    // 8-bit RGB, no interlacing
+    unsigned char header[13] = {0};
+    put_u32(&header[0], width);
+    put_u32(&header[4], height);
+    header[8] = 8;
+    header[9] = 2;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (std::fwrite(kSignature, 1, sizeof(kSignature), file_) != sizeof(kSignature)) {
+        failed_ = true;
+    }
+    write_chunk("IHDR", header, sizeof(header));
+    return !failed_;
+}
+
+/*
+Encodes rows of a band, which start at pixels in the
+frame buffer. Called once per band, by any thread.
+*/
+void PngStream::encode_band(int band, const Pixel *pixels) {
+    if (!file_) { return; }
+    MRTP_TRACE_SCOPE_ARG("encode band", band);
+
+    int nrows = std::min(bandrows_, height_ - band * bandrows_);
+    std::vector<unsigned char> raw;
+    filter_rows(pixels, nrows, &raw);
+
+    std::vector<unsigned char> out;
+    if (band == 0) { out.assign(kZlibHeader, kZlibHeader + sizeof(kZlibHeader)); }
+    bool deflated = deflate_rows(&raw, band == nbands_ - 1, &out);
+    unsigned long adler = adler32(adler32(0L, nullptr, 0), raw.data(), raw.size());
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!deflated) { failed_ = true; }
+    deflated_[band].swap(out);
+    adlers_[band] = adler;
+    lengths_[band] = raw.size();
+    encoded_[band] = 1;
+    write_ready();
+}
+
+/*
+Encodes bands left over, e.g. when the time budget ran
+out, and completes the file. Returns false if any part
+of the file could not be written.
+*/
+bool PngStream::finish(const Pixel *framebuffer) {
+    if (!file_) { return false; }
+
+    nstreamed_ = static_cast<int>(std::count(encoded_.begin(), encoded_.end(), 1));
+    for (int band = 0; band < nbands_; band++) {
+        if (!encoded_[band]) {
+            encode_band(band, &framebuffer[static_cast<size_t>(band) * bandrows_ * width_]);
+        }
+    }
+
+    unsigned char trailer[4];
+    put_u32(trailer, adler_);
+    write_chunk("IDAT", trailer, sizeof(trailer));
+    write_chunk("IEND", nullptr, 0);
+
+    bool ok = (!failed_) && (!std::ferror(file_));
+    if (std::fclose(file_) != 0) { ok = false; }
+    file_ = nullptr;
+    return ok;
+}
+
+int PngStream::get_bands() { return nbands_; }
+
+/*
+Bands encoded while rendering, known after finish.
+*/
+int PngStream::get_streamed() { return nstreamed_; }
+
+/*
+Quantizes pixels like Renderer::write_png and filters
+each row with the filter that gives the lowest sum.
+*/
+void PngStream::filter_rows(const Pixel *pixels, int nrows, std::vector<unsigned char> *raw) {
+    int size = width_ * kChannels;
+    std::vector<unsigned char> rows(2 * size);
+    std::vector<unsigned char> trial(size + 1);
+    raw->resize(static_cast<size_t>(nrows) * (size + 1));
+
+    for (int j = 0; j < nrows; j++) {
+        unsigned char *row = &rows[(j % 2) * size];
+        const unsigned char *prior = (j > 0) ? &rows[((j + 1) % 2) * size] : nullptr;
+        const Pixel *in = &pixels[static_cast<size_t>(j) * width_];
+
+        for (int i = 0; i < width_; i++, in++) {
+            Pixel bytes = kRealToByte * (*in);
+            row[kChannels * i] = static_cast<unsigned char>(bytes[0]);
+            row[kChannels * i + 1] = static_cast<unsigned char>(bytes[1]);
+            row[kChannels * i + 2] = static_cast<unsigned char>(bytes[2]);
+        }
+
+        unsigned char *out = &(*raw)[static_cast<size_t>(j) * (size + 1)];
+        unsigned long best = filter_row(rf_none, row, prior, size, out);
+        const RowFilter_t filters[3] = {rf_sub, rf_up, rf_paeth};
+
+        for (int f = 0; f < 3; f++) {
+            if ((!prior) && (filters[f] != rf_sub)) { continue; }
+            unsigned long cost = filter_row(filters[f], row, prior, size, &trial[0]);
+            if (cost < best) {
+                best = cost;
+                std::memcpy(out, &trial[0], size + 1);
+            }
+        }
+    }
+}
+
+/*
+Appends raw rows to out as a raw deflate stream. Streams
+of bands but the last end with a sync flush, on a byte
+boundary, so that the next stream can follow right away.
+*/
+bool PngStream::deflate_rows(std::vector<unsigned char> *raw, bool last,
+                             std::vector<unsigned char> *out) {
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -kWindowBits,
+                     kMemoryLevel, Z_FILTERED) != Z_OK) {
+        return false;
+    }
+
+    size_t start = out->size();
+    out->resize(start + deflateBound(&stream, raw->size()) + kFlushMargin);
+    stream.next_in = raw->data();
+    stream.avail_in = static_cast<uInt>(raw->size());
+    stream.next_out = out->data() + start;
+    stream.avail_out = static_cast<uInt>(out->size() - start);
+
+    int status = deflate(&stream, (last) ? Z_FINISH : Z_SYNC_FLUSH);
+    bool ok = (last) ? (status == Z_STREAM_END) :
+                       ((status == Z_OK) && (stream.avail_in == 0) && (stream.avail_out > 0));
+
+    out->resize(out->size() - stream.avail_out);
+    deflateEnd(&stream);
+    return ok;
+}
+
+/*
+Writes bands that are next in order, called with the
+lock held. Their memory is released once written.
+*/
+void PngStream::write_ready() {
+    while ((nextband_ < nbands_) && (encoded_[nextband_])) {
+        std::vector<unsigned char> &data = deflated_[nextband_];
+        write_chunk("IDAT", data.data(), data.size());
+        adler_ = adler32_combine(adler_, adlers_[nextband_], lengths_[nextband_]);
+        std::vector<unsigned char>().swap(data);
+        nextband_++;
+    }
+}
+
+void PngStream::write_chunk(const char *type, const unsigned char *data, size_t size) {
+    unsigned char length[4];
+    unsigned char check[4];
+    const unsigned char *name = reinterpret_cast<const unsigned char *>(type);
+
+    unsigned long crc = crc32(crc32(0L, nullptr, 0), name, 4);
+    if (size > 0) { crc = crc32(crc, data, static_cast<uInt>(size)); }
+    put_u32(length, size);
+    put_u32(check, crc);
+
+    bool ok = (std::fwrite(length, 1, 4, file_) == 4) && (std::fwrite(name, 1, 4, file_) == 4);
+    if (size > 0) { ok = ok && (std::fwrite(data, 1, size, file_) == size); }
+    ok = ok && (std::fwrite(check, 1, 4, file_) == 4);
+    if (!ok) { failed_ = true; }
+}
+
+} //namespace mrtp
@@ -0,0 +1,238 @@
+/* File      : primitives.cpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#include "primitives.hpp"
+
+
+namespace mrtp {
+
+//Local functions
+
+/*
+Same order of summation as Eigen's dot() for Vector3f,
+so kernels give the same distances as Actor::solve.
+*/
+static inline float dot(float ax, float ay, float az, float bx, float by, float bz) {
+    return ax * bx + (ay * by + az * bz);
+}
+
+static inline float plane_distance(PlaneArray *planes, int i, const float *o,
+                                   const float *d, float maxd) {
+    float bar = dot(d[0], d[1], d[2], planes->nx[i], planes->ny[i], planes->nz[i]);
+
+    if (bar != 0.0f) {
+        float tx = o[0] - planes->cx[i];
+        float ty = o[1] - planes->cy[i];
+        float tz = o[2] - planes->cz[i];
+        float t = -dot(tx, ty, tz, planes->nx[i], planes->ny[i], planes->nz[i]) / bar;
+        if ((t >= 0.0f) && (t <= maxd)) {
+            return t;
+        }
+    }
+    return -1.0f;
+}
+
+static inline float sphere_distance(SphereArray *spheres, int i, const float *o,
+                                    const float *d, float maxd) {
+    float tx = o[0] - spheres->cx[i];
+    float ty = o[1] - spheres->cy[i];
+    float tz = o[2] - spheres->cz[i];
+    float R = spheres->radius[i];
+
+    float a = dot(d[0], d[1], d[2], d[0], d[1], d[2]);
+    float b = 2.0f * dot(d[0], d[1], d[2], tx, ty, tz);
+    float c = dot(tx, ty, tz, tx, ty, tz) - (R * R);
+
+    return Actor::solve_quadratic(a, b, c, 0.0f, maxd);
+}
+
+/*
+See Cylinder::solve for the derivation.
+*/
+static inline float cylinder_distance(CylinderArray *cylinders, int i, const float *o,
+                                      const float *d, float maxd) {
+    float tx = o[0] - cylinders->cx[i];
+    float ty = o[1] - cylinders->cy[i];
+    float tz = o[2] - cylinders->cz[i];
+    float bx = cylinders->ax[i];
+    float by = cylinders->ay[i];
+    float bz = cylinders->az[i];
+    float R = cylinders->radius[i];
+    float span = cylinders->span[i];
+
+    float a = dot(d[0], d[1], d[2], tx, ty, tz);
+    float b = dot(d[0], d[1], d[2], bx, by, bz);
+    float dd = dot(tx, ty, tz, bx, by, bz);
+    float f = (R * R) - dot(tx, ty, tz, tx, ty, tz);
+
+    float aa = 1.0f - (b * b);
+    float bb = 2.0f * (a - b * dd);
+    float cc = -(dd * dd) - f;
+    float t = Actor::solve_quadratic(aa, bb, cc, 0.0f, maxd);
+
+    if ((t > 0.0f) && (span > 0.0f)) {
+        float alpha = dd + t * b;
+        if ((alpha < -span) || (alpha > span)) {
+            return -1.0f;
+        }
+    }
+    return t;
+}
+
+//Member functions
+
+void PlaneArray::clear() { *this = PlaneArray(); }
+
+void PlaneArray::add(Plane *plane) {
+    Eigen::Vector3f center = plane->get_center();
+    Eigen::Vector3f normal = plane->get_normal();
+
+    cx.push_back(center[0]);
+    cy.push_back(center[1]);
+    cz.push_back(center[2]);
+    nx.push_back(normal[0]);
+    ny.push_back(normal[1]);
+    nz.push_back(normal[2]);
+    reflect.push_back(plane->get_reflect());
+    shadow.push_back(plane->has_shadow());
+    actors.push_back(plane);
+}
+
+void SphereArray::clear() { *this = SphereArray(); }
+
+void SphereArray::add(Sphere *sphere) {
+    Eigen::Vector3f center = sphere->get_center();
+
+    cx.push_back(center[0]);
+    cy.push_back(center[1]);
+    cz.push_back(center[2]);
+    radius.push_back(sphere->get_radius());
+    reflect.push_back(sphere->get_reflect());
+    shadow.push_back(sphere->has_shadow());
+    actors.push_back(sphere);
+}
+
+void CylinderArray::clear() { *this = CylinderArray(); }
+
+void CylinderArray::add(Cylinder *cylinder) {
+    Eigen::Vector3f center = cylinder->get_center();
+    Eigen::Vector3f direction = cylinder->get_direction();
+
+    cx.push_back(center[0]);
+    cy.push_back(center[1]);
+    cz.push_back(center[2]);
+    ax.push_back(direction[0]);
+    ay.push_back(direction[1]);
+    az.push_back(direction[2]);
+    radius.push_back(cylinder->get_radius());
+    span.push_back(cylinder->get_span());
+    reflect.push_back(cylinder->get_reflect());
+    shadow.push_back(cylinder->has_shadow());
+    actors.push_back(cylinder);
+}
+
+//Kernels
+
+/*
+Each kernel scans primitives [first, last) of one type.
+The solve kernels return the index of the closest
+primitive hit before currd, or -1, and update currd.
+The occlude kernels return the index of the first shadow
+casting primitive hit, or -1.
+*/
+int solve_planes(PlaneArray *planes, int first, int last,
+                 Eigen::Vector3f *origin, Eigen::Vector3f *direction,
+                 float maxd, float *currd) {
+    const float *o = origin->data();
+    const float *d = direction->data();
+    int hit = -1;
+
+    for (int i = first; i < last; i++) {
+        float t = plane_distance(planes, i, o, d, maxd);
+        if ((t > 0.0f) && (t < (*currd))) {
+            *currd = t;
+            hit = i;
+        }
+    }
+    return hit;
+}
+
+int solve_spheres(SphereArray *spheres, int first, int last,
+                  Eigen::Vector3f *origin, Eigen::Vector3f *direction,
+                  float maxd, float *currd) {
+    const float *o = origin->data();
+    const float *d = direction->data();
+    int hit = -1;
+
+    for (int i = first; i < last; i++) {
+        float t = sphere_distance(spheres, i, o, d, maxd);
+        if ((t > 0.0f) && (t < (*currd))) {
+            *currd = t;
+            hit = i;
+        }
+    }
+    return hit;
+}
+
+int solve_cylinders(CylinderArray *cylinders, int first, int last,
+                    Eigen::Vector3f *origin, Eigen::Vector3f *direction,
+                    float maxd, float *currd) {
+    const float *o = origin->data();
+    const float *d = direction->data();
+    int hit = -1;
+
+    for (int i = first; i < last; i++) {
+        float t = cylinder_distance(cylinders, i, o, d, maxd);
+        if ((t > 0.0f) && (t < (*currd))) {
+            *currd = t;
+            hit = i;
+        }
+    }
+    return hit;
+}
+
+int occlude_planes(PlaneArray *planes, int first, int last,
+                   Eigen::Vector3f *origin, Eigen::Vector3f *direction,
+                   float maxd) {
+    const float *o = origin->data();
+    const float *d = direction->data();
+
+    for (int i = first; i < last; i++) {
+        if (planes->shadow[i] && (plane_distance(planes, i, o, d, maxd) > 0.0f)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int occlude_spheres(SphereArray *spheres, int first, int last,
+                    Eigen::Vector3f *origin, Eigen::Vector3f *direction,
+                    float maxd) {
+    const float *o = origin->data();
+    const float *d = direction->data();
+
+    for (int i = first; i < last; i++) {
+        if (spheres->shadow[i] && (sphere_distance(spheres, i, o, d, maxd) > 0.0f)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int occlude_cylinders(CylinderArray *cylinders, int first, int last,
+                      Eigen::Vector3f *origin, Eigen::Vector3f *direction,
+                      float maxd) {
+    const float *o = origin->data();
+    const float *d = direction->data();
+
+    for (int i = first; i < last; i++) {
+        if (cylinders->shadow[i] && (cylinder_distance(cylinders, i, o, d, maxd) > 0.0f)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+} //namespace mrtp
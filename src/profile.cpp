@@ -0,0 +1,156 @@
+/* File      : profile.cpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "profile.hpp"
+
+
+namespace mrtp {
+
+static const char *kPhaseNames[kProfilePhases] = {"parse", "textures", "render", "write"};
+
+thread_local RayCounters rayCounters = RayCounters();
+
+
+void clear_counters(RayCounters *counters) {
+    bool enabled = counters->enabled;
+    *counters = RayCounters();
+    counters->enabled = enabled;
+}
+
+void add_counters(RayCounters *total, const RayCounters *counters) {
+    total->primary += counters->primary;
+    total->reflected += counters->reflected;
+    total->shadow += counters->shadow;
+    total->tests += counters->tests;
+    total->hits += counters->hits;
+    total->shadownanos += counters->shadownanos;
+    total->busynanos += counters->busynanos;
+    for (int k = 0; k < kProfileDepths; k++) { total->depths[k] += counters->depths[k]; }
+}
+
+static long long count_rays(const RayCounters *counters) {
+    return counters->primary + counters->reflected + counters->shadow;
+}
+
+/*
+Levels of recursion up to the deepest one reached.
+*/
+static int count_depths(const RayCounters *counters) {
+    int ndepths = kProfileDepths;
+    while ((ndepths > 1) && (counters->depths[ndepths - 1] == 0)) { ndepths--; }
+    return ndepths;
+}
+
+static std::string quote(const std::string &text) {
+    std::string quoted = "\"";
+    for (size_t k = 0; k < text.size(); k++) {
+        if ((text[k] == '"') || (text[k] == '\\')) { quoted += '\\'; }
+        quoted += text[k];
+    }
+    return quoted + "\"";
+}
+
+Profile::Profile(const char *scene) : scene_(scene), total_(RayCounters()) {
+    for (int k = 0; k < kProfilePhases; k++) { phases_[k] = 0.0f; }
+}
+
+void Profile::set_phase(ProfilePhase_t phase, float seconds) {
+    phases_[phase] = seconds;
+}
+
+void Profile::add_thread(const RayCounters *counters) {
+    threads_.push_back(*counters);
+    add_counters(&total_, counters);
+}
+
+long long Profile::get_rays() { return count_rays(&total_); }
+
+long long Profile::get_tests() { return total_.tests; }
+
+/*
+Millions of rays of all threads per second of wall
+time of rendering.
+*/
+float Profile::get_rate() {
+    float seconds = phases_[pp_render];
+    return (seconds > 0.0f) ? 1.0e-6f * static_cast<float>(get_rays()) / seconds : 0.0f;
+}
+
+void Profile::print() {
+    std::cout << std::setprecision(3) << "  phases:";
+    for (int k = 0; k < kProfilePhases; k++) {
+        std::cout << ((k > 0) ? ", " : " ") << kPhaseNames[k] << " " << phases_[k] << "s";
+    }
+    std::cout << std::endl;
+
+    std::cout << "  rays: " << total_.primary << " primary, " << total_.reflected
+              << " reflected, " << total_.shadow << " shadow (" << get_rate()
+              << " Mrays/s)" << std::endl;
+
+    long long nrays = total_.primary + total_.reflected;
+    float pertest = (nrays > 0) ? static_cast<float>(total_.tests) / nrays : 0.0f;
+    std::cout << "  intersection tests: " << total_.tests << ", " << total_.hits
+              << " hits (" << pertest << " tests per ray)" << std::endl;
+
+    std::cout << "  rays per depth:";
+    for (int k = 0; k < count_depths(&total_); k++) { std::cout << " " << total_.depths[k]; }
+    std::cout << std::endl;
+
+    for (size_t k = 0; k < threads_.size(); k++) {
+        std::cout << "  thread " << k << ": " << count_rays(&threads_[k]) << " rays, "
+                  << threads_[k].tests << " tests, busy "
+                  << 1.0e-9f * static_cast<float>(threads_[k].busynanos) << "s" << std::endl;
+    }
+}
+
+std::string Profile::to_json() {
+    std::ostringstream out;
+    out << std::setprecision(6);
+
+    out << "{\"scene\": " << quote(scene_) << ", \"phases\": {";
+    for (int k = 0; k < kProfilePhases; k++) {
+        out << ((k > 0) ? ", " : "") << "\"" << kPhaseNames[k] << "\": " << phases_[k];
+    }
+    out << "}, \"rays\": {\"primary\": " << total_.primary << ", \"reflected\": "
+        << total_.reflected << ", \"shadow\": " << total_.shadow << ", \"total\": "
+        << get_rays() << "}, \"mrays_per_second\": " << get_rate() << ", \"tests\": "
+        << total_.tests << ", \"hits\": " << total_.hits << ", \"depths\": [";
+    for (int k = 0; k < count_depths(&total_); k++) {
+        out << ((k > 0) ? ", " : "") << total_.depths[k];
+    }
+
+    out << "], \"threads\": [";
+    for (size_t k = 0; k < threads_.size(); k++) {
+        RayCounters *thread = &threads_[k];
+        out << ((k > 0) ? ", " : "") << "{\"primary\": " << thread->primary
+            << ", \"reflected\": " << thread->reflected << ", \"shadow\": " << thread->shadow
+            << ", \"tests\": " << thread->tests << ", \"hits\": " << thread->hits
+            << ", \"busy\": " << 1.0e-9 * static_cast<double>(thread->busynanos) << "}";
+    }
+    out << "]}";
+    return out.str();
+}
+
+/*
+Writes profiles of all scenes so far as a JSON array.
+*/
+bool write_profiles(const char *path, std::vector<Profile> *profiles) {
+    std::ofstream file(path);
+    if (!file) { return false; }
+
+    file << "[";
+    for (size_t k = 0; k < profiles->size(); k++) {
+        file << ((k > 0) ? ",\n " : "") << (*profiles)[k].to_json();
+    }
+    file << "]" << std::endl;
+    return static_cast<bool>(file);
+}
+
+} //namespace mrtp
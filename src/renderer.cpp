@@ -4,9 +4,12 @@
  * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
  */
 #include <Eigen/Geometry>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
-#include <ctime>
+#include <new>
 
 #ifdef _OPENMP
 #include <omp.h>
@@ -14,12 +17,32 @@
 
 #include "png.hpp"
 #include "renderer.hpp"
+#include "trace.hpp"
 
 
 namespace mrtp {
 
 static const float kDegreeToRadian = M_PI / 180.0f;
 static const float kRealToByte = 255.0f;
+static const int kDefaultTileSize = 32;
+static const float kDefaultThreshold = 0.1f;
+static const int kProbeSamples = 4;
+static const int kMaxSamples = 64;
+static const float kDefaultPreviewInterval = 5.0f;
+static const float kDefaultMapBias = 0.05f;
+static const int kMapRowsPerJob = 8;
+static const int kDefaultLightSamples = 8;
+static const float kMinCosine = 0.01f;
+
+// Names of passes in traces, in order of RenderPass_t
+static const char *const kPassNames[] = {"shadow map", "coarse", "primary", "detect", "refine"};
+
+/*
+State kept by each rendering thread: the last occluder
+of a shadow ray. Ray counts are kept in rayCounters and
+added to the totals of the renderer after each pass.
+*/
+static thread_local OccluderCache occluderCache = {0, at_plane, 0};
 
 /*
 distance: a distance to fully darken the light
@@ -32,28 +55,256 @@ Renderer::Renderer(World *world, int width, int height, float fov,
                    float distance, float shadow, float bias, int maxdepth,
                    int nthreads, const char *path) : 
     world_(world), 
+    path_(path),
+    framebuffer_(nullptr),
+    fbbytes_(0),
     width_(width), 
     height_(height), 
-    fov_(fov), 
+    maxdepth_(maxdepth), 
+    nthreads_(nthreads), 
+    packetsize_(1),
+    tilesize_(kDefaultTileSize),
+    tileorder_(to_scanline),
+    backend_(kDefaultBackend),
+    pass_(rp_primary),
+    minsamples_(1),
+    maxsamples_(1),
+    threshold_(kDefaultThreshold),
+    stride_(1),
+    passstride_(1),
+    previewinterval_(kDefaultPreviewInterval),
+    budget_(0.0f),
+    stats_(false),
+    wavefront_(false),
+    raysort_(so_none),
+    mapsize_(0),
+    mapbias_(kDefaultMapBias),
+    usemap_(false),
+    lightsamples_(kDefaultLightSamples),
+    manylights_(false),
+    filtering_(false),
+    spread_(0.0f),
+    heatmap_(hm_none),
+    tilecols_(0),
+    ntiles_(0),
+    streaming_(false),
+    outofcore_(false),
+    banded_(false),
+    format_(of_png),
+    output_(-1),
+    headersize_(0),
+    lastpass_(rp_primary),
     maxdist_(distance), 
     shadow_(shadow), 
     bias_(bias), 
-    maxdepth_(maxdepth), 
-    nthreads_(nthreads), 
-    path_(path) {
+    fov_(fov) {
 
     ratio_ = static_cast<float>(width_) / static_cast<float>(height_);
     perspective_ = ratio_ / (2.0f * std::tan(kDegreeToRadian * fov_ / 2.0f));
 
-    Pixel dummy;
-    framebuffer_.assign(width_ * height_, dummy);
+    expired_ = false;
+    outputfailed_ = false;
+}
+
+Renderer::~Renderer() {
+    if (framebuffer_) { munmap(framebuffer_, fbbytes_); }
+    if (output_ >= 0) { close(output_); }
+}
+
+/*
+Size of ray packets for primary and shadow rays:
+1 traces single rays, 0 picks a size matching
+the SIMD width of the CPU (4, 8 or 16).
+*/
+void Renderer::set_packet_size(int size) {
+    packetsize_ = (size == 0) ? detect_packet_size() : size;
+}
+
+/*
+Size of square tiles handed out to threads
+and the order in which they are rendered.
+*/
+void Renderer::set_tiles(int size, TileOrder_t order) {
+    tilesize_ = size;
+    tileorder_ = order;
+}
+
+/*
+Parallel rendering runs either in OpenMP threads or on
+the persistent thread pool. The pool is started on first
+use unless it was started before, e.g. with pinning.
+*/
+void Renderer::set_backend(ParallelBackend_t backend) {
+    backend_ = backend;
+}
+
+/*
+Adaptive anti-aliasing: after one sample per pixel, pixels
+that differ from a neighbour by more than threshold in any
+channel, or show a different actor, are traced again with
+maxsamples stratified samples. Other pixels get minsamples.
+Sample counts are squares: 1, 4, 9, 16, etc.
+*/
+void Renderer::set_antialias(int minsamples, int maxsamples, float threshold) {
+    minsamples_ = minsamples;
+    maxsamples_ = maxsamples;
+    threshold_ = threshold;
+}
+
+/*
+Progressive rendering: the frame is first filled with one
+ray per stride x stride block, then the stride is halved
+in each pass until the full resolution pass. stride
+should be a power of 2, 1 turns it off.
+*/
+void Renderer::set_progressive(int stride) {
+    stride_ = stride;
+}
+
+/*
+If path is not empty, a preview image is written there
+after each pass, as long as at least interval seconds
+passed since the last one.
+*/
+void Renderer::set_preview(const char *path, float interval) {
+    previewpath_ = path;
+    previewinterval_ = interval;
+}
+
+/*
+Rendering stops taking new tiles once seconds of wall
+clock time have passed, leaving the frame buffer as it
+is after the last finished tile. 0 means no limit.
+*/
+void Renderer::set_time_budget(float seconds) {
+    budget_ = seconds;
+}
+
+bool Renderer::budget_expired() { return expired_; }
+
+/*
+With statistics on, rays and intersection tests are
+counted by each thread, and shadow rays timed on their
+own, to report their throughput.
+*/
+void Renderer::set_stats(bool stats) {
+    stats_ = stats;
 }
 
-Renderer::~Renderer() {}
+/*
+The wavefront renderer traces primary rays of a tile
+in stages, each bounce of reflected rays as one batch.
+Batches can be sorted between bounces.
+*/
+void Renderer::set_wavefront(bool wavefront, RaySort_t sort) {
+    wavefront_ = wavefront;
+    raysort_ = sort;
+}
 
+/*
+Shadows from a cube shadow map of resolution x resolution
+texels per face, built once per frame, instead of shadow
+rays. Points farther than bias behind the closest actor
+seen from the light are shadowed. 0 keeps shadow rays.
+The map is used only in scenes with a single light.
+*/
+void Renderer::set_shadow_map(int resolution, float bias) {
+    mapsize_ = resolution;
+    mapbias_ = bias;
+}
+
+/*
+In scenes with several lights, each hit is shaded with
+at most count lights picked from the light tree, each
+with its own shadow ray.
+*/
+void Renderer::set_light_samples(int count) {
+    lightsamples_ = count;
+}
+
+/*
+Streams the output image while rendering: each band of
+rows, one tile high, is encoded by the thread finishing
+its last tile in the last pass.
+*/
+void Renderer::set_streaming(bool streaming) {
+    streaming_ = streaming;
+}
+
+int Renderer::get_streamed_bands() { return stream_.get_streamed(); }
+
+/*
+Renders gigapixel images without holding them in memory:
+tiles go in scanline order, and each band of rows, one
+tile high, is written to the output file once finished
+and its memory handed back. Anti-aliasing, progressive
+rendering and previews need the whole image, so they
+are not available.
+*/
+void Renderer::set_out_of_core(bool outofcore) {
+    outofcore_ = outofcore;
+}
+
+/*
+Records the cost of each tile while rendering, for
+write_heatmap. The metric sets the colors of the
+heatmap, both are written to the CSV file.
+*/
+void Renderer::set_heatmap(HeatMetric_t metric) {
+    heatmap_ = metric;
+}
+
+/*
+PNG files are quantized to 8 bits. PPM skips compression,
+PFM and raw files keep floats, see output.cpp.
+*/
+void Renderer::set_output_format(OutputFormat_t format) {
+    format_ = format;
+}
+
+long long Renderer::get_shadow_rays() {
+    long long total = 0;
+    for (size_t k = 0; k < counters_.size(); k++) { total += counters_[k].shadow; }
+    return total;
+}
+
+/*
+Time spent on shadow rays, summed over threads.
+*/
+float Renderer::get_shadow_time() {
+    long long total = 0;
+    for (size_t k = 0; k < counters_.size(); k++) { total += counters_[k].shadownanos; }
+    return static_cast<float>(total) * 1.0e-9f;
+}
+
+/*
+Adds ray counts of each thread that took part in the
+last rendering to a profile.
+*/
+void Renderer::get_profile(Profile *profile) {
+    for (size_t k = 0; k < counters_.size(); k++) { profile->add_thread(&counters_[k]); }
+}
+
+/*
+Writes the image in the output format. When bands were
+written while rendering, only those left are written.
+*/
 bool Renderer::write_scene() {
+    MRTP_TRACE_SCOPE("write scene");
+    if (banded_ && (format_ == of_png)) {
+        return (stream_.finish(framebuffer_)) ? rs_ok : rs_fail;
+    }
+    if (banded_) { return close_output(); }
+
+    if (format_ == of_ppm) { return write_ppm(path_); }
+    if (format_ == of_pfm) { return write_pfm(path_); }
+    if (format_ == of_raw) { return write_raw(path_); }
+    return write_png(path_);
+}
+
+bool Renderer::write_png(const char *path) {
     png::image<png::rgb_pixel> image(width_, height_);
-    Pixel *in = &framebuffer_[0];
+    Pixel *in = framebuffer_;
 
     for (int i = 0; i < height_; i++) {
         png::rgb_pixel *out = &image[i][0];
@@ -65,52 +316,263 @@ bool Renderer::write_scene() {
             out->blue = static_cast<unsigned char>(bytes[2]);
         }
     }
-    image.write(path_);
+    image.write(path);
     return rs_ok;
 }
 
+/*
+Shadow rays go to the hierarchy of shadow casting actors
+only. They are counted with statistics or a heatmap on,
+and timed with statistics on.
+With a shadow map, the origin is looked up instead.
+*/
 bool Renderer::solve_shadows(Eigen::Vector3f *origin, Eigen::Vector3f *direction,
                              float maxdist) {
-    std::vector<Actor *> actors = world_->ptr_actors_;
-    std::vector<Actor *>::iterator iter = actors.begin();
-    std::vector<Actor *>::iterator iter_end = actors.end();
-
-    for (; iter != iter_end; ++iter) {
-        Actor *actor = *iter;
-        if (actor->has_shadow()) {
-            float distance = actor->solve(origin, direction, 0.0f, maxdist);
-            if (distance > 0.0f) {
-                return true;
-            }
+    if (usemap_) {
+        return shadowmap_.lookup(origin, mapbias_) != nullptr;
+    }
+    if (!stats_) {
+        if (rayCounters.enabled) { rayCounters.shadow++; }
+        return world_->occluders_.solve_shadows(origin, direction, maxdist, &occluderCache);
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool isshadow = world_->occluders_.solve_shadows(origin, direction, maxdist, &occluderCache);
+    rayCounters.shadownanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    rayCounters.shadow++;
+    return isshadow;
+}
+
+void Renderer::solve_shadows_packet(RayPacket *packet) {
+    if (usemap_) {
+        for (int i = 0; i < packet->size; i++) {
+            if (!packet->active[i]) { continue; }
+            Eigen::Vector3f origin(packet->ox[i], packet->oy[i], packet->oz[i]);
+            packet->hit[i] = shadowmap_.lookup(&origin, mapbias_);
         }
+        return;
     }
-    return false;
+    if (!stats_) {
+        if (rayCounters.enabled) {
+            for (int i = 0; i < packet->size; i++) { rayCounters.shadow += packet->active[i]; }
+        }
+        world_->occluders_.solve_shadows_packet(packet, &occluderCache);
+        return;
+    }
+
+    // Occluded lanes are retired while traversing, so they are counted first
+    long long nrays = 0;
+    for (int i = 0; i < packet->size; i++) { nrays += packet->active[i]; }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    world_->occluders_.solve_shadows_packet(packet, &occluderCache);
+    rayCounters.shadownanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    rayCounters.shadow += nrays;
 }
 
+/*
+On input, currd must not exceed the maximum distance.
+*/
 Actor *Renderer::solve_hits(Eigen::Vector3f *origin, Eigen::Vector3f *direction,
                             float *currd) {
-    std::vector<Actor *> actors = world_->ptr_actors_;
-    std::vector<Actor *>::iterator iter = actors.begin();
-    std::vector<Actor *>::iterator iter_end = actors.end();
-    Actor *hit = nullptr;
+    return world_->bvh_.solve_hits(origin, direction, currd);
+}
+
+/*
+Counts a ray traced at a level of recursion, 0 for
+primary rays.
+*/
+void Renderer::count_ray(int depth, bool hit) {
+    if (!rayCounters.enabled) { return; }
+
+    if (depth == 0) { rayCounters.primary++; }
+    else { rayCounters.reflected++; }
+    rayCounters.depths[std::min(depth, kProfileDepths - 1)]++;
+    if (hit) { rayCounters.hits++; }
+}
+
+/*
+Width of a pixel at a hit currd along a ray, used to
+filter textures: the distance from the eye through the
+origin of the ray, times the angle of a pixel. It grows
+at grazing angles with the square root of the cosine,
+which keeps the area of the footprint rather than its
+length. 0 if textures are not filtered.
+*/
+float Renderer::calculate_footprint(Eigen::Vector3f *origin, Eigen::Vector3f *direction,
+                                    float currd, Eigen::Vector3f *normal) {
+    if (!filtering_) { return 0.0f; }
+
+    Eigen::Vector3f eye = world_->ptr_camera_->get_eye();
+    float distance = ((*origin) - eye).norm() + currd;
+    float cosine = std::max(std::fabs(direction->dot(*normal)), kMinCosine);
+    return distance * spread_ / std::sqrt(cosine);
+}
+
+/*
+Color of a lit intersection without reflections.
+*/
+Pixel Renderer::shade_local(Actor *hitactor, Eigen::Vector3f *inter,
+                            Eigen::Vector3f *normal, float lightd, float intensity,
+                            bool isshadow, float footprint) {
+    Pixel pixel;
+    pixel << 0.0f, 0.0f, 0.0f;
+
+    float shadow = (isshadow) ? shadow_ : 1.0f;
+
+    // Decrease light intensity for actors away from the light
+    float ambient = 1.0f - std::pow(lightd / maxdist_, 2);
+
+    // Combine pixels, as bright as the power of the light allows
+    float lambda = std::min(world_->ptr_light_->get_power() * intensity * shadow * ambient, 1.0f);
+
+    Pixel pick = hitactor->pick_pixel(inter, normal, footprint);
+    pixel = (1.0f - lambda) * pixel + lambda * pick;
+    return pixel;
+}
+
+/*
+Color of an intersection lit by several lights, picked
+from the light tree. Lights behind the surface or out
+of reach add nothing. Shadow rays of the picked lights
+start at the same point, corr, and are traced as one
+packet if enabled. On output, lit tells if any picked
+light faces the surface.
+*/
+Pixel Renderer::shade_lights(Actor *hitactor, Eigen::Vector3f *inter,
+                             Eigen::Vector3f *normal, Eigen::Vector3f *corr,
+                             float footprint, bool *lit) {
+    LightSample samples[kMaxLightSamples];
+    Eigen::Vector3f tolight[kMaxLightSamples];
+    float lightd[kMaxLightSamples];
+    float intensity[kMaxLightSamples];
+    bool isshadow[kMaxLightSamples];
+
+    int nsamples = world_->lighttree_.select(inter, normal, maxdist_, lightsamples_, samples);
+    *lit = false;
+
+    for (int k = 0; k < nsamples; k++) {
+        tolight[k] = samples[k].light->calculate_ray(inter);
+        lightd[k] = tolight[k].norm();
+        tolight[k] *= (1.0f / lightd[k]);
+        intensity[k] = tolight[k].dot(*normal);
+        isshadow[k] = false;
+        if (intensity[k] > 0.0f) { *lit = true; }
+    }
+
+    if ((packetsize_ > 1) && (nsamples > 1)) {
+        RayPacket packet;
+        packet.size = (nsamples <= 4) ? 4 : ((nsamples <= 8) ? 8 : kMaxPacketSize);
+
+        for (int i = 0; i < packet.size; i++) {
+            // Unused lanes repeat the first light
+            int k = (i < nsamples) ? i : 0;
+            packet.active[i] = (i < nsamples) && (intensity[k] > 0.0f);
+            packet.ox[i] = (*corr)[0];
+            packet.oy[i] = (*corr)[1];
+            packet.oz[i] = (*corr)[2];
+            packet.dx[i] = tolight[k][0];
+            packet.dy[i] = tolight[k][1];
+            packet.dz[i] = tolight[k][2];
+            packet.maxd[i] = lightd[k];
+            packet.currd[i] = lightd[k];
+            packet.hit[i] = nullptr;
+        }
+        packet_prepare(&packet);
+        solve_shadows_packet(&packet);
+
+        for (int k = 0; k < nsamples; k++) { isshadow[k] = packet.hit[k] != nullptr; }
+    } else {
+        for (int k = 0; k < nsamples; k++) {
+            if (intensity[k] <= 0.0f) { continue; }
+            isshadow[k] = solve_shadows(corr, &tolight[k], lightd[k]);
+        }
+    }
+
+    float lambda = 0.0f;
+    for (int k = 0; k < nsamples; k++) {
+        float ambient = 1.0f - std::pow(lightd[k] / maxdist_, 2);
+        if ((intensity[k] <= 0.0f) || (ambient <= 0.0f)) { continue; }
+
+        float shadow = (isshadow[k]) ? shadow_ : 1.0f;
+        lambda += samples[k].weight * samples[k].light->get_power() * intensity[k] * shadow * ambient;
+    }
+
+    Pixel pixel;
+    pixel << 0.0f, 0.0f, 0.0f;
+    if (lambda > 0.0f) {
+        pixel = std::min(lambda, 1.0f) * hitactor->pick_pixel(inter, normal, footprint);
+    }
+    return pixel;
+}
+
+/*
+Shades a hit at currd along a ray in a scene with
+several lights, including reflections.
+*/
+Pixel Renderer::shade_many(Actor *hitactor, Eigen::Vector3f *origin,
+                           Eigen::Vector3f *direction, float currd, int depth) {
+    Eigen::Vector3f inter = ((*direction) * currd) + (*origin);
+    Eigen::Vector3f normal = hitactor->calculate_normal(&inter);
+    Eigen::Vector3f corr = inter + bias_ * normal;
+    float footprint = calculate_footprint(origin, direction, currd, &normal);
+    bool lit;
+
+    Pixel pixel = shade_lights(hitactor, &inter, &normal, &corr, footprint, &lit);
+    if (lit) { pixel = reflect_hit(hitactor, direction, &corr, &normal, pixel, depth); }
+    return pixel;
+}
+
+/*
+Adds the reflection to the local color of a hit,
+if the hit actor is reflective.
+*/
+Pixel Renderer::reflect_hit(Actor *hitactor, Eigen::Vector3f *direction,
+                            Eigen::Vector3f *corr, Eigen::Vector3f *normal,
+                            Pixel local, int depth) {
+    Pixel pixel = local;
 
-    for (; iter != iter_end; ++iter) {
-        Actor *actor = *iter;
-        float distance = actor->solve(origin, direction, 0.0f, maxdist_);
-        if ((distance > 0.0f) && (distance < (*currd))) {
-            *currd = distance;
-            hit = actor;
+    if (depth < maxdepth_) {
+        float coeff = hitactor->get_reflect();
+        if (coeff > 0.0f) {
+            Eigen::Vector3f ray = (*direction) - (2.0f * direction->dot(*normal)) * (*normal);
+            Pixel reflected = trace_ray_r(corr, &ray, depth + 1, nullptr);
+            pixel = (1.0f - coeff) * reflected + coeff * pixel;
         }
     }
-    return hit;
+    return pixel;
+}
+
+/*
+Shades a lit intersection once its shadow test is known.
+corr is the intersection moved off the surface.
+*/
+Pixel Renderer::shade_hit(Actor *hitactor, Eigen::Vector3f *direction,
+                          Eigen::Vector3f *inter, Eigen::Vector3f *corr,
+                          Eigen::Vector3f *normal, float lightd, float intensity,
+                          bool isshadow, float footprint, int depth) {
+    Pixel pixel = shade_local(hitactor, inter, normal, lightd, intensity, isshadow, footprint);
+    return reflect_hit(hitactor, direction, corr, normal, pixel, depth);
 }
 
-Pixel Renderer::trace_ray_r(Eigen::Vector3f *origin, Eigen::Vector3f *direction, int depth) {
+/*
+If primary is not null, the hit actor is stored there.
+*/
+Pixel Renderer::trace_ray_r(Eigen::Vector3f *origin, Eigen::Vector3f *direction, int depth,
+                            Actor **primary) {
     Pixel pixel;
     pixel << 0.0f, 0.0f, 0.0f;
 
     float currd = maxdist_;
     Actor *hitactor = solve_hits(origin, direction, &currd);
+    if (primary) { *primary = hitactor; }
+    count_ray(depth, hitactor != nullptr);
+
+    if (hitactor && manylights_) {
+        return shade_many(hitactor, origin, direction, currd, depth);
+    }
 
     if (hitactor) {
         Eigen::Vector3f inter = ((*direction) * currd) + (*origin);
@@ -130,94 +592,734 @@ Pixel Renderer::trace_ray_r(Eigen::Vector3f *origin, Eigen::Vector3f *direction,
 
             // Check if the intersection is in a shadow
             bool isshadow = solve_shadows(&corr, &tolight, lightd);
-            float shadow = (isshadow) ? shadow_ : 1.0f;
+            float footprint = calculate_footprint(origin, direction, currd, &normal);
 
-            // Decrease light intensity for actors away from the light
-            float ambient = 1.0f - std::pow(lightd / maxdist_, 2);
+            pixel = shade_hit(hitactor, direction, &inter, &corr, &normal, lightd,
+                              intensity, isshadow, footprint, depth);
+        }
+    }
+    return pixel;
+}
+
+/*
+Traces a block of primary rays starting at pixel (x, y)
+as one packet. Pixels at or beyond xend, yend are
+masked out.
+*/
+void Renderer::trace_packet(int x, int y, int xend, int yend) {
+    Camera *camera = world_->ptr_camera_;
+    RayPacket packet;
+    Pixel pixels[kMaxPacketSize];
+    int width, height;
 
-            // Combine pixels
-            float lambda = intensity * shadow * ambient;
+    packet_shape(packetsize_, &width, &height);
+    packet.size = packetsize_;
 
-            Pixel pick = hitactor->pick_pixel(&inter, &normal);
-            pixel = (1.0f - lambda) * pixel + lambda * pick;
+    for (int i = 0; i < packetsize_; i++) {
+        int px = x + i % width;
+        int py = y + i / width;
+        Eigen::Vector3f origin = camera->calculate_origin(px, py);
+        Eigen::Vector3f direction = camera->calculate_direction(&origin);
 
-            // If the hit actor is reflective, trace a reflected ray
-            if (depth < maxdepth_) {
-                float coeff = hitactor->get_reflect();
-                if (coeff > 0.0f) {
-                    Eigen::Vector3f ray = (*direction) - (2.0f * direction->dot(normal)) * normal;
-                    Pixel reflected = trace_ray_r(&corr, &ray, depth + 1);
-                    pixel = (1.0f - coeff) * reflected + coeff * pixel;
-                }
+        packet.active[i] = (px < xend) && (py < yend);
+        packet.ox[i] = origin[0];
+        packet.oy[i] = origin[1];
+        packet.oz[i] = origin[2];
+        packet.dx[i] = direction[0];
+        packet.dy[i] = direction[1];
+        packet.dz[i] = direction[2];
+    }
+    shade_packet(&packet, pixels);
+
+    for (int i = 0; i < packetsize_; i++) {
+        if (!packet.active[i]) { continue; }
+
+        size_t index = (x + i % width) + static_cast<size_t>(y + i / width) * width_;
+        framebuffer_[index] = pixels[i];
+        if (!hitbuffer_.empty()) { hitbuffer_[index] = packet.hit[i]; }
+    }
+}
+
+/*
+Traces primary rays set up in packet (origins, directions
+and active lanes), followed by a packet of shadow rays.
+On output, pixels holds the colors of active lanes and
+packet->hit the actors hit by primary rays.
+
+Reflected rays diverge, so they are traced one by one.
+With several lights, hits are shaded one by one as well.
+*/
+void Renderer::shade_packet(RayPacket *packet, Pixel *pixels) {
+    RayPacket shadows;
+    shadows.size = packet->size;
+
+    for (int i = 0; i < packet->size; i++) {
+        packet->maxd[i] = maxdist_;
+        packet->currd[i] = maxdist_;
+        packet->hit[i] = nullptr;
+    }
+    packet_prepare(packet);
+    world_->bvh_.solve_hits_packet(packet);
+
+    for (int i = 0; i < packet->size; i++) {
+        if (packet->active[i]) { count_ray(0, packet->hit[i] != nullptr); }
+    }
+
+    if (manylights_) {
+        for (int i = 0; i < packet->size; i++) {
+            if (!packet->active[i]) { continue; }
+
+            pixels[i] << 0.0f, 0.0f, 0.0f;
+            if (packet->hit[i]) {
+                Eigen::Vector3f origin(packet->ox[i], packet->oy[i], packet->oz[i]);
+                Eigen::Vector3f direction(packet->dx[i], packet->dy[i], packet->dz[i]);
+                pixels[i] = shade_many(packet->hit[i], &origin, &direction, packet->currd[i], 0);
             }
         }
+        return;
+    }
+
+    Eigen::Vector3f inter[kMaxPacketSize];
+    Eigen::Vector3f normal[kMaxPacketSize];
+    Eigen::Vector3f corr[kMaxPacketSize];
+    float lightd[kMaxPacketSize];
+    float intensity[kMaxPacketSize];
+
+    for (int i = 0; i < packet->size; i++) {
+        Eigen::Vector3f origin(packet->ox[i], packet->oy[i], packet->oz[i]);
+        Eigen::Vector3f direction(packet->dx[i], packet->dy[i], packet->dz[i]);
+
+        shadows.active[i] = 0;
+        shadows.hit[i] = nullptr;
+        intensity[i] = 0.0f;
+        lightd[i] = maxdist_;
+        corr[i] = origin;
+        Eigen::Vector3f tolight = direction;
+
+        Actor *hitactor = packet->hit[i];
+        if (hitactor) {
+            inter[i] = (direction * packet->currd[i]) + origin;
+            normal[i] = hitactor->calculate_normal(&inter[i]);
+
+            tolight = world_->ptr_light_->calculate_ray(&inter[i]);
+            lightd[i] = tolight.norm();
+            tolight *= (1.0f / lightd[i]);
+            intensity[i] = tolight.dot(normal[i]);
+
+            if (intensity[i] > 0.0f) {
+                corr[i] = inter[i] + bias_ * normal[i];
+                shadows.active[i] = 1;
+            }
+        }
+        shadows.ox[i] = corr[i][0];
+        shadows.oy[i] = corr[i][1];
+        shadows.oz[i] = corr[i][2];
+        shadows.dx[i] = tolight[0];
+        shadows.dy[i] = tolight[1];
+        shadows.dz[i] = tolight[2];
+        shadows.maxd[i] = lightd[i];
+        shadows.currd[i] = lightd[i];
+    }
+    packet_prepare(&shadows);
+    solve_shadows_packet(&shadows);
+
+    for (int i = 0; i < packet->size; i++) {
+        if (!packet->active[i]) { continue; }
+
+        Pixel pixel;
+        pixel << 0.0f, 0.0f, 0.0f;
+
+        if ((packet->hit[i]) && (intensity[i] > 0.0f)) {
+            Eigen::Vector3f origin(packet->ox[i], packet->oy[i], packet->oz[i]);
+            Eigen::Vector3f direction(packet->dx[i], packet->dy[i], packet->dz[i]);
+            float footprint = calculate_footprint(&origin, &direction, packet->currd[i], &normal[i]);
+            pixel = shade_hit(packet->hit[i], &direction, &inter[i], &corr[i], &normal[i],
+                              lightd[i], intensity[i], shadows.hit[i] != nullptr, footprint, 0);
+        }
+        pixels[i] = pixel;
     }
-    return pixel;
 }
 
-void Renderer::render_block(int block, int nlines) {
-    Pixel *pixel = &framebuffer_[block * nlines * width_];
+void Renderer::render_tile(Tile *tile) {
+    if (wavefront_) {
+        render_tile_wavefront(tile);
+        return;
+    }
+
+    if (packetsize_ > 1) {
+        int width, height;
+        packet_shape(packetsize_, &width, &height);
+
+        for (int j = tile->y; j < tile->yend; j += height) {
+            for (int i = tile->x; i < tile->xend; i += width) {
+                trace_packet(i, j, tile->xend, tile->yend);
+            }
+        }
+        return;
+    }
 
-    for (int j = 0; j < nlines; j++) {
-        for (int i = 0; i < width_; i++, pixel++) {
-            Eigen::Vector3f origin = world_->ptr_camera_->calculate_origin(i, j + block * nlines);
+    bool record = !hitbuffer_.empty();
+    Actor *hitactor;
+
+    for (int j = tile->y; j < tile->yend; j++) {
+        Pixel *pixel = &framebuffer_[static_cast<size_t>(j) * width_ + tile->x];
+
+        for (int i = tile->x; i < tile->xend; i++, pixel++) {
+            Eigen::Vector3f origin = world_->ptr_camera_->calculate_origin(i, j);
             Eigen::Vector3f direction = world_->ptr_camera_->calculate_direction(&origin);
-            *pixel = trace_ray_r(&origin, &direction, 0);
+            *pixel = trace_ray_r(&origin, &direction, 0, &hitactor);
+            if (record) { hitbuffer_[j * width_ + i] = hitactor; }
         }
     }
 }
 
 /*
-In parallel mode, splits the frame buffer into several
-horizontal blocks, each rendered by a separate thread.
+Traces one ray per block of passstride_ pixels and fills
+the block with its color. Blocks start at the tile corner,
+so that they never cross into other tiles. Rays already
+traced in the previous, twice coarser, pass are skipped.
+*/
+void Renderer::coarse_tile(Tile *tile) {
+    int s = passstride_;
+    bool first = (s == stride_);
 
-After each thread has finished, there may still be
-some left-over lines to render.
+    for (int j = tile->y; j < tile->yend; j += s) {
+        int jend = (j + s < tile->yend) ? j + s : tile->yend;
 
-If nthreads=0, uses as many threads as available.
+        for (int i = tile->x; i < tile->xend; i += s) {
+            if ((!first) && ((i - tile->x) % (2 * s) == 0) && ((j - tile->y) % (2 * s) == 0)) {
+                continue;
+            }
+            Eigen::Vector3f origin = world_->ptr_camera_->calculate_origin(i, j);
+            Eigen::Vector3f direction = world_->ptr_camera_->calculate_direction(&origin);
+            Pixel pixel = trace_ray_r(&origin, &direction, 0, nullptr);
 
-Returns rendering time in seconds, corrected for
-the number of threads.
+            int iend = (i + s < tile->xend) ? i + s : tile->xend;
+            for (int y = j; y < jend; y++) {
+                for (int x = i; x < iend; x++) {
+                    framebuffer_[static_cast<size_t>(y) * width_ + x] = pixel;
+                }
+            }
+        }
+    }
+}
+
+/*
+Compares each pixel with its right and lower neighbours.
+Bit 0 of refine_ marks a difference to the right, bit 1
+below, so that each pair of pixels is checked once.
+Only the first pass is read here, so tiles can be
+checked in parallel.
 */
-float Renderer::render_scene() {
-    world_->ptr_camera_->calculate_window(width_, height_, perspective_);
+void Renderer::detect_tile(Tile *tile) {
+    for (int j = tile->y; j < tile->yend; j++) {
+        int down = (j < height_ - 1) ? width_ : 0;
 
-    int time_start = clock();
+        for (int i = tile->x; i < tile->xend; i++) {
+            int index = j * width_ + i;
+            int others[2] = {(i < width_ - 1) ? index + 1 : index, index + down};
+
+            const Pixel &pixel = framebuffer_[index];
+            Actor *actor = hitbuffer_[index];
+            int refine = 0;
+
+            for (int k = 0; k < 2; k++) {
+                const Pixel &other = framebuffer_[others[k]];
+                int differ = (hitbuffer_[others[k]] != actor) |
+                             (std::fabs(pixel[0] - other[0]) > threshold_) |
+                             (std::fabs(pixel[1] - other[1]) > threshold_) |
+                             (std::fabs(pixel[2] - other[2]) > threshold_);
+                refine |= differ << k;
+            }
+            refine_[index] = static_cast<unsigned char>(refine);
+        }
+    }
+}
+
+/*
+A pixel needs more samples if it differs from any of its
+four neighbours, as marked by detect_tile.
+*/
+bool Renderer::needs_refine(int i, int j) {
+    int index = j * width_ + i;
+    return (refine_[index] != 0) ||
+           ((i > 0) && (refine_[index - 1] & 1)) ||
+           ((j > 0) && (refine_[index - width_] & 2));
+}
+
+/*
+Pixels are refined in batches that fill a packet:
+flagged pixels get a 2x2 probe, others minsamples.
+*/
+void Renderer::refine_tile(Tile *tile) {
+    int nprobe = (minsamples_ < kProbeSamples) ? kProbeSamples : minsamples_;
+    int nflaggedmax = batch_size(nprobe);
+    int nplainmax = batch_size(minsamples_);
+
+    int flagged[kMaxPacketSize];
+    int plain[kMaxPacketSize];
+    int nflagged = 0;
+    int nplain = 0;
+
+    for (int j = tile->y; j < tile->yend; j++) {
+        for (int i = tile->x; i < tile->xend; i++) {
+            int index = j * width_ + i;
+
+            if (needs_refine(i, j)) {
+                flagged[nflagged++] = index;
+                if (nflagged == nflaggedmax) {
+                    refine_pixels(flagged, nflagged, true);
+                    nflagged = 0;
+                }
+            } else if (minsamples_ > 1) {
+                plain[nplain++] = index;
+                if (nplain == nplainmax) {
+                    refine_pixels(plain, nplain, false);
+                    nplain = 0;
+                }
+            }
+        }
+    }
+    if (nflagged > 0) { refine_pixels(flagged, nflagged, true); }
+    if (nplain > 0) { refine_pixels(plain, nplain, false); }
+}
+
+/*
+Number of pixels whose samples fit in one packet.
+*/
+int Renderer::batch_size(int nsamples) {
+    if ((packetsize_ > 1) && (nsamples < kMaxPacketSize)) {
+        return kMaxPacketSize / nsamples;
+    }
+    return 1;
+}
+
+/*
+Flagged pixels are first probed with a 2x2 grid. Only if
+the probe samples disagree by more than the threshold,
+the full grid of maxsamples is traced and both are
+averaged. Smooth gradients and textures stop early.
+*/
+void Renderer::refine_pixels(const int *pixels, int count, bool flagged) {
+    int nprobe = (minsamples_ < kProbeSamples) ? kProbeSamples : minsamples_;
+    int nsamples = (flagged) ? ((nprobe < maxsamples_) ? nprobe : maxsamples_) : minsamples_;
+
+    Pixel colors[kMaxPacketSize];
+    float spread[kMaxPacketSize];
+    trace_samples(pixels, count, nsamples, colors, spread);
+
+    for (int p = 0; p < count; p++) {
+        if (flagged && (nsamples < maxsamples_) && (spread[p] > threshold_)) {
+            Pixel full;
+            float unused;
+            trace_samples(&pixels[p], 1, maxsamples_, &full, &unused);
+            colors[p] = (static_cast<float>(nsamples) * colors[p] + static_cast<float>(maxsamples_) * full) *
+                        (1.0f / static_cast<float>(nsamples + maxsamples_));
+        }
+        framebuffer_[pixels[p]] = colors[p];
+    }
+}
+
+/*
+Primary ray through sample k of a pixel. Samples lie at
+the centers of a square grid of n x n cells, centered on
+the single sample of the first pass, so that refined
+and plain pixels line up.
+*/
+Eigen::Vector3f Renderer::calculate_sample(int pixel, int k, int n, Eigen::Vector3f *direction) {
+    float step = 1.0f / static_cast<float>(n);
+    float sx = static_cast<float>(pixel % width_) + (static_cast<float>(k % n) + 0.5f) * step - 0.5f;
+    float sy = static_cast<float>(pixel / width_) + (static_cast<float>(k / n) + 0.5f) * step - 0.5f;
+
+    Eigen::Vector3f origin = world_->ptr_camera_->calculate_subpixel(sx, sy);
+    *direction = world_->ptr_camera_->calculate_direction(&origin);
+    return origin;
+}
+
+/*
+Traces nsamples per pixel for count pixels, in packets
+if enabled. On output, colors holds the average of each
+pixel and spread the largest difference between its
+samples in any channel.
+*/
+void Renderer::trace_samples(const int *pixels, int count, int nsamples, Pixel *colors,
+                             float *spread) {
+    Pixel samples[kMaxSamples];
+    int n = static_cast<int>(std::lround(std::sqrt(static_cast<float>(nsamples))));
+    int total = count * nsamples;
+    Eigen::Vector3f origin, direction;
+
+    if (packetsize_ > 1) {
+        RayPacket packet;
+        packet.size = (total <= 4) ? 4 : kMaxPacketSize;
+
+        for (int first = 0; first < total; first += packet.size) {
+            for (int i = 0; i < packet.size; i++) {
+                // Unused lanes repeat the first sample
+                int k = ((first + i) < total) ? (first + i) : first;
+                origin = calculate_sample(pixels[k / nsamples], k % nsamples, n, &direction);
+
+                packet.active[i] = (first + i) < total;
+                packet.ox[i] = origin[0];
+                packet.oy[i] = origin[1];
+                packet.oz[i] = origin[2];
+                packet.dx[i] = direction[0];
+                packet.dy[i] = direction[1];
+                packet.dz[i] = direction[2];
+            }
+            shade_packet(&packet, &samples[first]);
+        }
+    } else {
+        for (int k = 0; k < total; k++) {
+            origin = calculate_sample(pixels[k / nsamples], k % nsamples, n, &direction);
+            samples[k] = trace_ray_r(&origin, &direction, 0, nullptr);
+        }
+    }
+
+    for (int p = 0; p < count; p++) {
+        Pixel *first = &samples[p * nsamples];
+        Pixel sum = first[0];
+        Pixel lower = first[0];
+        Pixel upper = first[0];
+
+        for (int k = 1; k < nsamples; k++) {
+            sum += first[k];
+            lower = lower.cwiseMin(first[k]);
+            upper = upper.cwiseMax(first[k]);
+        }
+        colors[p] = sum * (1.0f / static_cast<float>(nsamples));
+        spread[p] = (upper - lower).maxCoeff();
+    }
+}
+
+/*
+Runs on each thread. Tiles are taken from a shared
+counter until none are left, so threads that get cheap
+tiles simply take more of them. Once the time budget
+is used up, no more tiles are taken.
+
+The shadow map pass hands out bands of map rows
+instead of tiles.
+*/
+void Renderer::render_tiles() {
+    long long ntiles = ntiles_;
+    int nrows = shadowmap_.get_rows();
+    long long index;
+
+    if (pass_ == rp_shadow_map) {
+        ntiles = (nrows + kMapRowsPerJob - 1) / kMapRowsPerJob;
+    }
+
+    // Tile costs are measured with the counters of statistics
+    rayCounters.enabled = stats_ || (heatmap_ != hm_none);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    while ((index = nexttile_.fetch_add(1)) < ntiles) {
+        if ((budget_ > 0.0f) && (elapsed(timestart_) > budget_)) {
+            expired_ = true;
+            break;
+        }
+        MRTP_TRACE_SCOPE_ARG(kPassNames[pass_], index);
+        // Textures evicted before this tile are no longer read by this thread
+        textureCollector.enter_reading();
+
+        if (pass_ == rp_shadow_map) {
+            int first = static_cast<int>(index) * kMapRowsPerJob;
+            int last = (first + kMapRowsPerJob < nrows) ? first + kMapRowsPerJob : nrows;
+            shadowmap_.build_rows(&world_->occluders_, first, last, packetsize_);
+        }
+        else {
+            Tile tile = tile_at(index);
+            RayCounters before = rayCounters;
+            std::chrono::steady_clock::time_point tilestart = std::chrono::steady_clock::now();
+
+            if (pass_ == rp_coarse) { coarse_tile(&tile); }
+            else if (pass_ == rp_primary) { render_tile(&tile); }
+            else if (pass_ == rp_detect) { detect_tile(&tile); }
+            else { refine_tile(&tile); }
+
+            if (heatmap_ != hm_none) { record_cost(&tile, tilestart, &before); }
+
+            if (banded_ && (pass_ == lastpass_)) { finish_tile(&tile); }
+        }
+    }
+    textureCollector.leave_reading();
+
+    if (rayCounters.enabled) {
+        rayCounters.busynanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        merge_counters();
+    }
+}
+
+/*
+Adds the cost of a tile since start to the tile, whose
+counters were before on start. Each tile is taken by one
+thread in a pass, so threads never share a cost.
+*/
+void Renderer::record_cost(Tile *tile, std::chrono::steady_clock::time_point start,
+                           const RayCounters *before) {
+    TileCost *cost = &tilecosts_[(tile->y / tilesize_) * tilecols_ + tile->x / tilesize_];
+    cost->nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    cost->tests += rayCounters.tests - before->tests;
+    cost->rays += (rayCounters.primary - before->primary) +
+                  (rayCounters.reflected - before->reflected) +
+                  (rayCounters.shadow - before->shadow);
+}
+
+/*
+Adds counts of the calling thread to those it added in
+earlier passes, threads are told apart by their id.
+*/
+void Renderer::merge_counters() {
+    std::lock_guard<std::mutex> lock(countermutex_);
+    std::thread::id id = std::this_thread::get_id();
+
+    size_t slot = std::find(counterids_.begin(), counterids_.end(), id) - counterids_.begin();
+    if (slot == counterids_.size()) {
+        counterids_.push_back(id);
+        counters_.push_back(RayCounters());
+    }
+    add_counters(&counters_[slot], &rayCounters);
+    clear_counters(&rayCounters);
+}
+
+/*
+Counts down tiles of the band of rows holding the tile,
+the last tile done flushes the band.
+*/
+void Renderer::finish_tile(Tile *tile) {
+    int band = tile->y / tilesize_;
+    if (bandtiles_[band].fetch_sub(1) == 1) { flush_band(band); }
+}
+
+/*
+Encodes or writes a finished band to the output file.
+Out of core, its pixels are then handed back.
+*/
+void Renderer::flush_band(int band) {
+    MRTP_TRACE_SCOPE_ARG("flush band", band);
+    size_t first = static_cast<size_t>(band) * tilesize_ * width_;
+    int nrows = std::min(tilesize_, height_ - band * tilesize_);
+
+    if (format_ == of_png) { stream_.encode_band(band, &framebuffer_[first]); }
+    else { write_band(band); }
+
+    if (outofcore_) { release_pixels(first, static_cast<size_t>(nrows) * width_); }
+}
+
+/*
+Tiles out of core are not stored, since there may be
+millions of them. They follow in scanline order.
+*/
+Tile Renderer::tile_at(long long index) {
+    if (!outofcore_) { return tiles_[index]; }
+
+    Tile tile;
+    tile.x = static_cast<int>(index % tilecols_) * tilesize_;
+    tile.y = static_cast<int>(index / tilecols_) * tilesize_;
+    tile.xend = std::min(tile.x + tilesize_, width_);
+    tile.yend = std::min(tile.y + tilesize_, height_);
+    return tile;
+}
+
+/*
+The frame buffer is mapped without reserving memory, so
+that pages are only allocated once pixels are written.
+It is kept between calls of render_scene, and cleared,
+so that tiles not rendered yet read as black in previews
+and in images cut short by the time budget.
+*/
+void Renderer::allocate_framebuffer() {
+    if (framebuffer_) {
+        madvise(framebuffer_, fbbytes_, MADV_DONTNEED);
+        return;
+    }
+
+    size_t bytes = static_cast<size_t>(width_) * height_ * sizeof(Pixel);
+    void *mapping = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED) { throw std::bad_alloc(); }
+
+    framebuffer_ = static_cast<Pixel *>(mapping);
+    fbbytes_ = bytes;
+}
+
+/*
+Hands pages of pixels back to the system, they read as
+zeros if touched again. Pages shared with neighbouring
+bands are kept.
+*/
+void Renderer::release_pixels(size_t first, size_t count) {
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t start = reinterpret_cast<size_t>(&framebuffer_[first]);
+    size_t end = reinterpret_cast<size_t>(&framebuffer_[first + count]);
+
+    start = (start + page - 1) / page * page;
+    end = end / page * page;
+    if (end > start) { madvise(reinterpret_cast<void *>(start), end - start, MADV_DONTNEED); }
+}
+
+/*
+Runs one pass over all tiles and returns
+the number of threads that took part.
+*/
+int Renderer::run_pass(RenderPass_t pass) {
+    MRTP_TRACE_SCOPE_TEXT("pass", kPassNames[pass]);
+    pass_ = pass;
+    nexttile_ = 0;
+    int nworkers = 1;
 
-#ifdef _OPENMP
     if (nthreads_ == 1) {
         // Serial execution
-        render_block(0, height_);
+        render_tiles();
+    } else if (backend_ == pb_pool) {
+        // Parallel execution on the persistent thread pool, restarted
+        // only if it runs a different number of threads
+        threadPool.start(nthreads_, threadPool.get_pin());
+        nworkers = threadPool.get_size();
+        threadPool.run([this] { render_tiles(); });
     } else {
-        // Parallel execution
+#ifdef _OPENMP
+        // Parallel execution with OpenMP
         if (nthreads_ != 0) {
             omp_set_num_threads(nthreads_);
         }
-        int nlines = height_ / nthreads_;
-        int block;
+#pragma omp parallel
+        {
+#pragma omp single
+            nworkers = omp_get_num_threads();
 
-#pragma omp parallel for
-        for (block = 0; block < nthreads_; block++) {
-            render_block(block, nlines);
+            render_tiles();
         }
+#else
+        // No OpenMP compiled in, do serial execution
+        render_tiles();
+#endif //_OPENMP
+    }
 
-        int nfill = height_ % nthreads_;
-        if (nfill) {
-            render_block(block + 1, nfill);
-        }
+    return nworkers;
+}
+
+float Renderer::elapsed(std::chrono::steady_clock::time_point since) {
+    std::chrono::duration<float> delta = std::chrono::steady_clock::now() - since;
+    return delta.count();
+}
+
+/*
+Writes a preview between passes, when no thread is
+touching the frame buffer. The first preview is written
+right away, later ones once the interval passed. The
+last one, after the final pass, is always written, so
+that the preview ends up the same as the image.
+*/
+void Renderer::write_preview(bool last) {
+    if (previewpath_.empty()) { return; }
+    if ((!last) && (expired_ || ((npreviews_ > 0) &&
+                                 (elapsed(lastpreview_) < previewinterval_)))) {
+        return;
     }
-#else
-    // No OpenMP compiled in, always do serial execution
-    render_block(0, height_);
+    MRTP_TRACE_SCOPE("write preview");
+
+    write_png(previewpath_.c_str());
+    lastpreview_ = std::chrono::steady_clock::now();
+    npreviews_++;
+}
 
-#endif //!_OPENMP
+/*
+Splits the frame buffer into small tiles, which are
+handed out to threads one by one.
+
+If nthreads=0, uses as many threads as available.
 
-    int time_stop = std::clock();
-    float time_used = static_cast<float>(time_stop - time_start) / CLOCKS_PER_SEC;
-    if (nthreads_ > 1) {
-        time_used *= 1.0f / static_cast<float>(nthreads_);
+With a shadow map, it is built first, in parallel
+like tiles. In progressive mode, coarse passes run
+after that. Passes
+left when the time budget runs out are skipped. If the
+output file of banded rendering cannot be opened, no
+pass runs at all.
+
+Returns wall time of rendering in seconds.
+*/
+float Renderer::render_scene() {
+    MRTP_TRACE_SCOPE("render scene");
+    world_->ptr_camera_->calculate_window(width_, height_, perspective_);
+    allocate_framebuffer();
+
+    tilecols_ = (width_ + tilesize_ - 1) / tilesize_;
+    int tilerows = (height_ + tilesize_ - 1) / tilesize_;
+    // Out of core, there may be more tiles than an int holds
+    ntiles_ = static_cast<long long>(tilecols_) * tilerows;
+    if (outofcore_) {
+        tiles_.clear();
+    } else {
+        generate_tiles(width_, height_, tilesize_, tileorder_, &tiles_);
     }
-    return time_used;
+
+    // Anti-aliasing adds a detection and a refinement pass
+    bool antialias = (maxsamples_ > 1);
+    lastpass_ = (antialias) ? rp_refine : rp_primary;
+
+    // Rows of tiles are written once done in the last pass
+    banded_ = streaming_ || outofcore_;
+    bool opened = true;
+    if (banded_) {
+        if (format_ == of_png) { opened = stream_.open(path_, width_, height_, tilesize_); }
+        else { opened = open_output(); }
+        std::vector<std::atomic<int> >(tilerows).swap(bandtiles_);
+        for (size_t k = 0; k < bandtiles_.size(); k++) { bandtiles_[k] = tilecols_; }
+    }
+    if (heatmap_ != hm_none) {
+        tilecosts_.assign(ntiles_, TileCost());
+    } else {
+        tilecosts_.clear();
+    }
+    if (antialias) {
+        hitbuffer_.assign(width_ * height_, nullptr);
+        refine_.assign(width_ * height_, 0);
+    } else {
+        hitbuffer_.clear();
+        refine_.clear();
+    }
+
+    timestart_ = std::chrono::steady_clock::now();
+    lastpreview_ = timestart_;
+    npreviews_ = 0;
+    expired_ = false;
+    counters_.clear();
+    counterids_.clear();
+
+    // Nothing is traced into an output file that failed, write_scene reports it
+    if (!opened) { return elapsed(timestart_); }
+
+    manylights_ = world_->ptr_lights_.size() > 1;
+    filtering_ = textureCollector.get_filter() != tf_nearest;
+    spread_ = 1.0f / (static_cast<float>(width_) * perspective_);
+    usemap_ = (mapsize_ > 0) && (!manylights_);
+    if (usemap_) {
+        Eigen::Vector3f center = world_->ptr_light_->get_center();
+        shadowmap_.setup(&center, mapsize_, maxdist_);
+        run_pass(rp_shadow_map);
+    }
+
+    // Coarse passes of progressive rendering
+    for (passstride_ = stride_; (passstride_ > 1) && (!expired_); passstride_ /= 2) {
+        run_pass(rp_coarse);
+        write_preview(false);
+    }
+
+    if (!expired_) {
+        run_pass(rp_primary);
+        if (antialias) { write_preview(false); }
+    }
+    if (antialias && (!expired_)) {
+        run_pass(rp_detect);
+        run_pass(rp_refine);
+    }
+    write_preview(true);
+
+    return elapsed(timestart_);
 }
 
 } //namespace mrtp
@@ -0,0 +1,135 @@
+/* File      : shadowmap.cpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#include <cmath>
+
+#include "shadowmap.hpp"
+
+
+namespace mrtp {
+
+ShadowMap::ShadowMap() : resolution_(0), maxd_(0.0f) {}
+
+ShadowMap::~ShadowMap() {}
+
+/*
+Allocates faces of resolution x resolution texels around
+center. Texels are empty until their rows are built.
+*/
+void ShadowMap::setup(Eigen::Vector3f *center, int resolution, float maxd) {
+    center_ = *center;
+    resolution_ = resolution;
+    maxd_ = maxd;
+    depth_.assign(6 * resolution * resolution, maxd);
+    occluder_.assign(6 * resolution * resolution, nullptr);
+}
+
+/*
+Rows of all faces, which can be built independently.
+*/
+int ShadowMap::get_rows() { return 6 * resolution_; }
+
+/*
+Direction through the center of texel (x, y) of a face.
+The major axis of the face is followed by the next two
+axes in cyclic order, as in lookup.
+*/
+Eigen::Vector3f ShadowMap::texel_direction(int face, int x, int y) {
+    int axis = face / 2;
+    float scale = 2.0f / static_cast<float>(resolution_);
+
+    Eigen::Vector3f direction;
+    direction[axis] = (face % 2) ? -1.0f : 1.0f;
+    direction[(axis + 1) % 3] = (static_cast<float>(x) + 0.5f) * scale - 1.0f;
+    direction[(axis + 2) % 3] = (static_cast<float>(y) + 0.5f) * scale - 1.0f;
+    return direction.normalized();
+}
+
+/*
+Traces rays from the light through texels of rows
+first..last-1, in packets along each row if enabled.
+*/
+void ShadowMap::build_rows(Bvh *occluders, int first, int last, int packetsize) {
+    for (int row = first; row < last; row++) {
+        int face = row / resolution_;
+        int y = row % resolution_;
+
+        if (packetsize > 1) {
+            for (int x = 0; x < resolution_; x += packetsize) {
+                build_packet(occluders, row, x, packetsize);
+            }
+            continue;
+        }
+
+        for (int x = 0; x < resolution_; x++) {
+            Eigen::Vector3f direction = texel_direction(face, x, y);
+            float currd = maxd_;
+            int texel = row * resolution_ + x;
+
+            occluder_[texel] = occluders->solve_hits(&center_, &direction, &currd);
+            depth_[texel] = currd;
+        }
+    }
+}
+
+void ShadowMap::build_packet(Bvh *occluders, int row, int x, int packetsize) {
+    int face = row / resolution_;
+    int y = row % resolution_;
+    RayPacket packet;
+    packet.size = packetsize;
+
+    for (int i = 0; i < packetsize; i++) {
+        int tx = (x + i < resolution_) ? x + i : x;
+        Eigen::Vector3f direction = texel_direction(face, tx, y);
+
+        packet.active[i] = (x + i) < resolution_;
+        packet.ox[i] = center_[0];
+        packet.oy[i] = center_[1];
+        packet.oz[i] = center_[2];
+        packet.dx[i] = direction[0];
+        packet.dy[i] = direction[1];
+        packet.dz[i] = direction[2];
+        packet.maxd[i] = maxd_;
+        packet.currd[i] = maxd_;
+        packet.hit[i] = nullptr;
+    }
+    packet_prepare(&packet);
+    occluders->solve_hits_packet(&packet);
+
+    for (int i = 0; (i < packetsize) && (x + i < resolution_); i++) {
+        int texel = row * resolution_ + x + i;
+        occluder_[texel] = packet.hit[i];
+        depth_[texel] = packet.currd[i];
+    }
+}
+
+/*
+Returns the actor that shadows point, or null if point
+is lit. The point is in a shadow if the texel in its
+direction holds an actor closer to the light than the
+point, by more than bias.
+*/
+Actor *ShadowMap::lookup(Eigen::Vector3f *point, float bias) {
+    Eigen::Vector3f delta = (*point) - center_;
+    Eigen::Vector3f size = delta.cwiseAbs();
+
+    int axis = 0;
+    if (size[1] > size[axis]) { axis = 1; }
+    if (size[2] > size[axis]) { axis = 2; }
+    if (size[axis] == 0.0f) { return nullptr; }
+
+    int face = 2 * axis + (delta[axis] < 0.0f);
+    float scale = 0.5f * static_cast<float>(resolution_) / size[axis];
+    int x = static_cast<int>((delta[(axis + 1) % 3] + size[axis]) * scale);
+    int y = static_cast<int>((delta[(axis + 2) % 3] + size[axis]) * scale);
+    x = (x < resolution_) ? x : resolution_ - 1;
+    y = (y < resolution_) ? y : resolution_ - 1;
+
+    int texel = (face * resolution_ + y) * resolution_ + x;
+    if (depth_[texel] < delta.norm() - bias) { return occluder_[texel]; }
+    return nullptr;
+}
+
+} //namespace mrtp
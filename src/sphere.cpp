@@ -12,9 +12,10 @@
 namespace mrtp {
 
 Sphere::Sphere(Eigen::Vector3f *center, float radius, Eigen::Vector3f *axis, 
-               float reflect, const char *texture) {
+               float reflect, const char *texture, TexelFormat_t format) {
     center_ = *center;
     R_ = radius;
+    type_ = at_sphere;
     has_shadow_ = true;
     reflect_ = reflect;
 
@@ -26,7 +27,7 @@ Sphere::Sphere(Eigen::Vector3f *center, float radius, Eigen::Vector3f *axis,
     tz_ = ty_.cross(tx_);
     tz_ *= (1.0f / tz_.norm());
 
-    texture_ = textureCollector.add(texture);
+    texture_ = textureCollector.add(texture, format);
 }
 
 Sphere::~Sphere() {}
@@ -41,16 +42,27 @@ float Sphere::solve(Eigen::Vector3f *origin, Eigen::Vector3f *direction, float m
     return solve_quadratic(a, b, c, mind, maxd);
 }
 
+Eigen::Vector3f Sphere::get_center() { return center_; }
+
+float Sphere::get_radius() { return R_; }
+
 Eigen::Vector3f Sphere::calculate_normal(Eigen::Vector3f *hit) {
     Eigen::Vector3f normal = (*hit) - center_;
     return (normal * (1.0f / normal.norm()));
 }
 
+bool Sphere::calculate_bounds(Eigen::Vector3f *lower, Eigen::Vector3f *upper) {
+    Eigen::Vector3f radius(R_, R_, R_);
+    *lower = center_ - radius;
+    *upper = center_ + radius;
+    return true;
+}
+
 /*
 Guidelines:
 https://www.cs.unc.edu/~rademach/xroads-RT/RTarticle.html
 */
-Pixel Sphere::pick_pixel(Eigen::Vector3f *hit, Eigen::Vector3f *normal) {
+Pixel Sphere::pick_pixel(Eigen::Vector3f *hit, Eigen::Vector3f *normal, float footprint) {
     float dot = normal->dot(ty_);
     float phi = std::acos(-dot);
     float fracy = phi / M_PI;
@@ -60,6 +72,11 @@ Pixel Sphere::pick_pixel(Eigen::Vector3f *hit, Eigen::Vector3f *normal) {
     dot = normal->dot(tz_);
     float fracx = (dot > 0.0f) ? theta : (1.0f - theta);
 
+    // Texture spans the circumference in x, half of it in y
+    if (footprint > 0.0f) {
+        float footy = footprint / (M_PI * R_);
+        return texture_->filter_pixel(fracx, fracy, 1.0f, 0.5f * footy, footy);
+    }
     return texture_->pick_pixel(fracx, fracy, 1.0f);
 }
 
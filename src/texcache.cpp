@@ -0,0 +1,196 @@
+/* File      : texcache.cpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include "texture.hpp"
+
+
+namespace mrtp {
+
+static const char kCacheMagic[8] = {'M', 'R', 'T', 'P', 'T', 'E', 'X', '\0'};
+static const int kCacheVersion = 1;
+static const int kMaxLevels = 32;
+static const size_t kCacheAlign = 64;
+
+/*
+Header of a cached texture. Texels follow at the next
+multiple of kCacheAlign bytes, exactly as they are kept
+in memory, so that the file can be mapped and used as
+it is. The source PNG is identified by its modification
+time and size.
+*/
+struct CacheHeader {
+    char magic[8];
+    int version;
+    int width;
+    int height;
+    int format;
+    int layout;
+    int levels;
+    long long mtime;
+    long long size;
+    unsigned long long bytes;
+    int offsets[kMaxLevels];
+    int widths[kMaxLevels];
+    int heights[kMaxLevels];
+    int strides[kMaxLevels];
+    int spans[kMaxLevels];
+};
+
+static const size_t kHeaderSize = ((sizeof(CacheHeader) + kCacheAlign - 1) / kCacheAlign) *
+                                  kCacheAlign;
+
+//Local functions
+
+static bool source_stamp(const char *path, long long *mtime, long long *size) {
+    struct stat info;
+    if (stat(path, &info) != 0) { return false; }
+    *mtime = static_cast<long long>(info.st_mtim.tv_sec) * 1000000000LL + info.st_mtim.tv_nsec;
+    *size = static_cast<long long>(info.st_size);
+    return true;
+}
+
+/*
+FNV-1a hash of a string.
+*/
+static unsigned long long hash_string(const std::string &text) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t k = 0; k < text.size(); k++) {
+        hash ^= static_cast<unsigned char>(text[k]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+//Member functions
+
+/*
+Name of the cached file in the cache directory. It is a
+hash of the absolute path of the source, its stamp, and
+of everything that changes the stored texels. Returns
+an empty string if the source cannot be found.
+*/
+std::string Texture::cache_file() {
+    long long mtime, size;
+    if (!source_stamp(spath_.c_str(), &mtime, &size)) { return std::string(); }
+
+    char *real = realpath(spath_.c_str(), nullptr);
+    std::string path = (real) ? real : spath_;
+    free(real);
+
+    std::stringstream key;
+    key << path << '|' << mtime << '|' << size << '|' << (filter_ != tf_nearest) << '|'
+        << format_ << '|' << layout_ << '|' << kCacheVersion;
+
+    std::stringstream name;
+    name << cache_ << '/' << std::hex << std::setw(16) << std::setfill('0')
+         << hash_string(key.str()) << ".mrtx";
+    return name.str();
+}
+
+/*
+Maps a cached texture read-only and points the texels
+into the mapping. Pages are shared with other processes
+that map the same file. Files that do not match the
+texture or its source are ignored.
+*/
+bool Texture::map_cache(const std::string &file, TexelStore *store) {
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) { return false; }
+
+    struct stat info;
+    if ((fstat(fd, &info) != 0) || (static_cast<size_t>(info.st_size) < kHeaderSize)) {
+        close(fd);
+        return false;
+    }
+    size_t length = static_cast<size_t>(info.st_size);
+    void *mapping = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) { return false; }
+
+    const CacheHeader *header = static_cast<const CacheHeader *>(mapping);
+    long long mtime = 0, size = 0;
+    bool valid = (memcmp(header->magic, kCacheMagic, sizeof(kCacheMagic)) == 0) &&
+                 (header->version == kCacheVersion) && (header->format == format_) &&
+                 (header->layout == layout_) && (header->levels >= 1) &&
+                 (header->levels <= kMaxLevels) &&
+                 (kHeaderSize + header->bytes == length) &&
+                 source_stamp(spath_.c_str(), &mtime, &size) &&
+                 (header->mtime == mtime) && (header->size == size);
+    if (!valid) {
+        munmap(mapping, length);
+        return false;
+    }
+
+    int levels = header->levels;
+    store->width = header->width;
+    store->height = header->height;
+    store->offsets.assign(header->offsets, header->offsets + levels);
+    store->widths.assign(header->widths, header->widths + levels);
+    store->heights.assign(header->heights, header->heights + levels);
+    store->strides.assign(header->strides, header->strides + levels);
+    store->spans.assign(header->spans, header->spans + levels);
+
+    store->mapping = mapping;
+    store->mapsize = length;
+    store->texels = static_cast<const unsigned char *>(mapping) + kHeaderSize;
+    return true;
+}
+
+/*
+Writes the loaded texture to the cache. The file is
+written under a temporary name and renamed, so that
+other processes never map a partial file. Failures
+leave the cache as it was.
+*/
+void Texture::write_cache(const std::string &file, TexelStore *store) {
+    int levels = static_cast<int>(store->offsets.size());
+    if (levels > kMaxLevels) { return; }
+
+    std::vector<char> block(kHeaderSize, 0);
+    CacheHeader *header = reinterpret_cast<CacheHeader *>(block.data());
+    memcpy(header->magic, kCacheMagic, sizeof(kCacheMagic));
+    header->version = kCacheVersion;
+    header->width = store->width;
+    header->height = store->height;
+    header->format = format_;
+    header->layout = layout_;
+    header->levels = levels;
+    if (!source_stamp(spath_.c_str(), &header->mtime, &header->size)) { return; }
+
+    size_t bytes = (format_ == tx_float) ? store->data.size() * sizeof(Pixel) :
+                                           store->bytes.size();
+    header->bytes = bytes;
+    std::copy(store->offsets.begin(), store->offsets.end(), header->offsets);
+    std::copy(store->widths.begin(), store->widths.end(), header->widths);
+    std::copy(store->heights.begin(), store->heights.end(), header->heights);
+    std::copy(store->strides.begin(), store->strides.end(), header->strides);
+    std::copy(store->spans.begin(), store->spans.end(), header->spans);
+
+    std::stringstream temp;
+    temp << file << '.' << getpid() << ".tmp";
+    FILE *out = fopen(temp.str().c_str(), "wb");
+    if (!out) { return; }
+
+    bool written = (fwrite(block.data(), kHeaderSize, 1, out) == 1) &&
+                   (fwrite(store->texels, bytes, 1, out) == 1);
+    written = (fclose(out) == 0) && written;
+
+    if (!written || (rename(temp.str().c_str(), file.c_str()) != 0)) {
+        remove(temp.str().c_str());
+    }
+}
+
+} //namespace mrtp
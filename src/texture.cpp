@@ -3,10 +3,21 @@
  * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
  * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
  */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstring>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "png.hpp"
 #include "texture.hpp"
+#include "threadpool.hpp"
+#include "trace.hpp"
 
 
 namespace mrtp {
@@ -14,12 +25,164 @@ namespace mrtp {
 static const float kRealToByte = 255.0f;
 static const float kByteToReal = 1.0f / kRealToByte;
 
+static const int kBlockSize = 4;
+static const int kBlockBytes = 8;
+static const int kTileBits = 3;
+static const int kTileSize = 1 << kTileBits;
+
 TextureCollector textureCollector;
 
+bool parse_texture_layout(const char *name, TextureLayout_t *layout) {
+    if (strcmp(name, "linear") == 0) { *layout = tl_linear; }
+    else if (strcmp(name, "tiled") == 0) { *layout = tl_tiled; }
+    else if (strcmp(name, "morton") == 0) { *layout = tl_morton; }
+    else { return false; }
+    return true;
+}
+
+bool parse_texel_format(const char *name, TexelFormat_t *format) {
+    if (strcmp(name, "float") == 0) { *format = tx_float; }
+    else if (strcmp(name, "rgb8") == 0) { *format = tx_rgb8; }
+    else if (strcmp(name, "rgba8") == 0) { *format = tx_rgba8; }
+    else if (strcmp(name, "bc1") == 0) { *format = tx_bc1; }
+    else { return false; }
+    return true;
+}
+
+//Helper functions for layouts and block compression
+
+/*
+Bytes with their bits spread to even bits, for Morton
+order.
+*/
+struct SpreadTable {
+    unsigned short bits[256];
+
+    SpreadTable() {
+        for (unsigned int value = 0; value < 256; value++) {
+            unsigned int spread = 0;
+            for (int k = 0; k < 8; k++) { spread |= ((value >> k) & 1) << (2 * k); }
+            bits[value] = static_cast<unsigned short>(spread);
+        }
+    }
+};
+
+static const SpreadTable spreadTable;
+
+/*
+Spreads the lower 16 bits of a value to even bits.
+*/
+static inline unsigned int spread_bits(unsigned int value) {
+    return spreadTable.bits[value & 0xff] | (spreadTable.bits[(value >> 8) & 0xff] << 16);
+}
+
+static unsigned int to_byte(float value) {
+    value = std::min(std::max(value, 0.0f), 1.0f);
+    return static_cast<unsigned int>(value * kRealToByte + 0.5f);
+}
+
+static unsigned int to_bits(float value, float levels) {
+    value = std::min(std::max(value, 0.0f), 1.0f);
+    return static_cast<unsigned int>(value * levels + 0.5f);
+}
+
+static unsigned int pack_565(const Pixel &color) {
+    return (to_bits(color[0], 31.0f) << 11) | (to_bits(color[1], 63.0f) << 5) |
+           to_bits(color[2], 31.0f);
+}
+
+static Pixel unpack_565(unsigned int color) {
+    return Pixel(static_cast<float>((color >> 11) & 31) * (1.0f / 31.0f),
+                 static_cast<float>((color >> 5) & 63) * (1.0f / 63.0f),
+                 static_cast<float>(color & 31) * (1.0f / 31.0f));
+}
+
+/*
+Fraction of the second endpoint in each of the four
+colors of a block, by index.
+*/
+static const float kBlockWeights[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+
+static Pixel decode_block(const unsigned char *block, int texel) {
+    unsigned int c0 = block[0] | (block[1] << 8);
+    unsigned int c1 = block[2] | (block[3] << 8);
+    unsigned int bits = block[4] | (block[5] << 8) | (block[6] << 16) |
+                        (static_cast<unsigned int>(block[7]) << 24);
+    float weight = kBlockWeights[(bits >> (2 * texel)) & 3];
 
-Texture::Texture(const char *path) : spath_(path) {}
+    Pixel first = unpack_565(c0);
+    return first + weight * (unpack_565(c1) - first);
+}
 
-Texture::~Texture() {}
+//Residency of textures under a memory budget
+
+/*
+Threads that read texels hold a slot with the epoch at
+which they started their current tile, or 0 in between.
+The epoch advances with every load and eviction. Stores
+of evicted textures are freed once no slot holds an epoch
+from before their eviction. Slots also count the samples
+of resident textures, without sharing cache lines.
+*/
+struct alignas(64) ReaderSlot {
+    std::atomic<unsigned long> epoch;
+    long long hits;
+};
+
+static const int kMaxReaders = 1024;
+
+static ReaderSlot readerSlots[kMaxReaders];
+static std::atomic<int> readerCount(0);
+static thread_local ReaderSlot *readerSlot = nullptr;
+
+static std::atomic<bool> residencyOn(false);
+static std::atomic<unsigned long> residencyEpoch(1);
+
+// Advances once per tile, textures are stamped with it when used
+static std::atomic<unsigned long> residencyClock(1);
+
+//Member functions
+
+TexelStore::TexelStore() : width(0), height(0), texels(nullptr), mapping(nullptr), mapsize(0) {}
+
+TexelStore::~TexelStore() {
+    if (mapping) { munmap(mapping, mapsize); }
+}
+
+/*
+Mapped textures count with the size of their file.
+*/
+size_t TexelStore::get_memory() {
+    return data.capacity() * sizeof(Pixel) + bytes.capacity() + mapsize;
+}
+
+Texture::Texture(const char *path, TextureFilter_t filter, TexelFormat_t format,
+                 TextureLayout_t layout, const char *cache) :
+    filter_(filter), format_(format), layout_(layout), spath_(path),
+    cache_((cache) ? cache : ""), store_(nullptr), lastuse_(0), loadtime_(0.0f) {}
+
+Texture::~Texture() {
+    delete store_.load();
+}
+
+/*
+Texels of the texture, loaded if needed. Under a memory
+budget, samples of resident textures are counted and
+mark the texture as recently used.
+*/
+inline TexelStore *Texture::acquire_store() {
+    TexelStore *store = store_.load(std::memory_order_acquire);
+    if (!store) { return load_lazily(); }
+
+    if (residencyOn.load(std::memory_order_relaxed)) {
+        unsigned long now = residencyClock.load(std::memory_order_relaxed);
+        if (lastuse_.load(std::memory_order_relaxed) != now) {
+            lastuse_.store(now, std::memory_order_relaxed);
+        }
+        if (readerSlot) { readerSlot->hits++; }
+    }
+    return store;
+}
 
 /*
 fracx, fracy are within a range of <0..1> and
@@ -28,52 +191,757 @@ of a texture.
 A reasonable scale for a 256x256 texture is 0.15.
 */
 Pixel Texture::pick_pixel(float fracx, float fracy, float scale) {
-    unsigned u = (static_cast<unsigned>(fracx * width_ * scale)) % width_;
-    unsigned v = (static_cast<unsigned>(fracy * height_ * scale)) % height_;
+    TexelStore *store = acquire_store();
+
+    unsigned u = (static_cast<unsigned>(fracx * store->width * scale)) % store->width;
+    unsigned v = (static_cast<unsigned>(fracy * store->height * scale)) % store->height;
 
-    return data_[u + v * width_];
+    return fetch(store, 0, u, v);
 }
 
-bool Texture::check_path(const char *path) {
-    return strcmp(path, spath_.c_str()) == 0;
+/*
+Position of texel x, y within its level. Tiles of 8x8
+texels follow each other in rows, texels within a tile
+are in rows as well. Morton order interleaves the bits
+of x and y, up to the bits of the shorter side. Both
+keep texels that are close in two dimensions close in
+memory.
+*/
+inline int Texture::texel_index(TexelStore *store, int level, int x, int y) {
+    switch (layout_) {
+        case tl_tiled:
+            return ((((y >> kTileBits) * store->spans[level]) + (x >> kTileBits)) << (2 * kTileBits)) |
+                   ((y & (kTileSize - 1)) << kTileBits) | (x & (kTileSize - 1));
+        case tl_morton: {
+            int bits = store->spans[level];
+            unsigned int mask = (1u << bits) - 1;
+            return static_cast<int>(spread_bits(x & mask) | (spread_bits(y & mask) << 1) |
+                                    ((static_cast<unsigned int>(x | y) >> bits) << (2 * bits)));
+        }
+        default:
+            return x + y * store->strides[level];
+    }
 }
 
+/*
+Reads one texel of a level, decoding it from the format
+in which the texture is stored.
+*/
+inline Pixel Texture::fetch(TexelStore *store, int level, int x, int y) {
+    const unsigned char *texel;
+
+    switch (format_) {
+        case tx_rgb8:
+            texel = store->texels + store->offsets[level] + 3 * texel_index(store, level, x, y);
+            return Pixel(static_cast<float>(texel[0]), static_cast<float>(texel[1]),
+                         static_cast<float>(texel[2])) * kByteToReal;
+        case tx_rgba8:
+            texel = store->texels + store->offsets[level] + 4 * texel_index(store, level, x, y);
+            return Pixel(static_cast<float>(texel[0]), static_cast<float>(texel[1]),
+                         static_cast<float>(texel[2])) * kByteToReal;
+        case tx_bc1:
+            texel = store->texels + store->offsets[level] +
+                    kBlockBytes * texel_index(store, level, x / kBlockSize, y / kBlockSize);
+            return decode_block(texel, (x % kBlockSize) + kBlockSize * (y % kBlockSize));
+        default:
+            return reinterpret_cast<const Pixel *>(store->texels)[store->offsets[level] +
+                                                            texel_index(store, level, x, y)];
+    }
+}
+
+/*
+Filtered lookup for a footprint of footx by footy, in
+the units of fracx and fracy. The level of the mip
+pyramid is picked so that the footprint covers about
+one texel. Bilinear filtering reads the closest level,
+trilinear blends the two closest ones.
+*/
+Pixel Texture::filter_pixel(float fracx, float fracy, float scale, float footx,
+                            float footy) {
+    TexelStore *store = acquire_store();
+
+    int last = static_cast<int>(store->offsets.size()) - 1;
+    float texels = std::max(footx * store->width, footy * store->height) * scale;
+    float lod = (texels > 1.0f) ? std::log2(texels) : 0.0f;
+    lod = std::min(lod, static_cast<float>(last));
+
+    if (filter_ == tf_bilinear) {
+        return sample_level(store, static_cast<int>(lod + 0.5f), fracx, fracy, scale);
+    }
+
+    int level = static_cast<int>(lod);
+    float blend = lod - static_cast<float>(level);
+    Pixel pixel = sample_level(store, level, fracx, fracy, scale);
+
+    if ((blend > 0.0f) && (level < last)) {
+        Pixel coarse = sample_level(store, level + 1, fracx, fracy, scale);
+        pixel = (1.0f - blend) * pixel + blend * coarse;
+    }
+    return pixel;
+}
+
+/*
+Bilinear lookup in one level of the pyramid. The texture
+repeats in both directions.
+*/
+Pixel Texture::sample_level(TexelStore *store, int level, float fracx, float fracy,
+                            float scale) {
+    int width = store->widths[level];
+    int height = store->heights[level];
+
+    float x = fracx * width * scale - 0.5f;
+    float y = fracy * height * scale - 0.5f;
+    float floorx = std::floor(x);
+    float floory = std::floor(y);
+    float fx = x - floorx;
+    float fy = y - floory;
+
+    int x0 = static_cast<int>(floorx - width * std::floor(floorx * (1.0f / width)));
+    int y0 = static_cast<int>(floory - height * std::floor(floory * (1.0f / height)));
+    if (x0 >= width) { x0 -= width; }
+    if (y0 >= height) { y0 -= height; }
+
+    // Undefined coordinates, e.g. at the poles of spheres
+    if ((x0 < 0) || (x0 >= width)) { x0 = 0; }
+    if ((y0 < 0) || (y0 >= height)) { y0 = 0; }
+    int x1 = (x0 + 1 < width) ? x0 + 1 : 0;
+    int y1 = (y0 + 1 < height) ? y0 + 1 : 0;
+
+    Pixel top = (1.0f - fx) * fetch(store, level, x0, y0) + fx * fetch(store, level, x1, y0);
+    Pixel bottom = (1.0f - fx) * fetch(store, level, x0, y1) + fx * fetch(store, level, x1, y1);
+    return (1.0f - fy) * top + fy * bottom;
+}
+
+size_t Texture::get_memory() {
+    TexelStore *store = store_.load(std::memory_order_acquire);
+    return (store) ? store->get_memory() : 0;
+}
+
+/*
+Loads the texture and publishes it to threads that
+sample it. Under a memory budget, the collector may
+evict other textures to make room.
+*/
 void Texture::load_texture() {
+    load_store();
+}
+
+/*
+Returns the texels it loaded, which stay valid for the
+current tile even if they are evicted right away.
+*/
+TexelStore *Texture::load_store() {
+    MRTP_TRACE_SCOPE_TEXT("load texture", spath_.c_str());
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    TexelStore *store = decode();
+    std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start;
+    loadtime_ += elapsed.count();
+
+    lastuse_.store(residencyClock.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    store_.store(store, std::memory_order_release);
+    if (residencyOn.load(std::memory_order_relaxed)) {
+        textureCollector.admit(this, store->get_memory());
+    }
+    return store;
+}
+
+bool Texture::is_loaded() { return store_.load(std::memory_order_acquire) != nullptr; }
+
+/*
+Seconds spent loading the texture, including reloads
+after evictions.
+*/
+float Texture::get_load_time() { return loadtime_; }
+
+unsigned long Texture::get_last_use() { return lastuse_.load(std::memory_order_relaxed); }
+
+/*
+Unpublishes the texels and hands them over to the
+collector, which frees them once no thread can still
+read them.
+*/
+TexelStore *Texture::evict() {
+    return store_.exchange(nullptr);
+}
+
+/*
+Loads a texture on its first sample. Threads that sample
+it at the same time wait for the first one.
+*/
+TexelStore *Texture::load_lazily() {
+    std::lock_guard<std::mutex> lock(loading_);
+    TexelStore *store = store_.load(std::memory_order_acquire);
+    return (store) ? store : load_store();
+}
+
+/*
+Decodes the texture from its PNG file, or maps it from
+the directory cache if it was decoded before in the same
+format and layout. Textures decoded with a cache are
+written to it. An empty cache turns caching off.
+*/
+TexelStore *Texture::decode() {
+    TexelStore *store = new TexelStore();
+    std::string file;
+    if (!cache_.empty()) {
+        file = cache_file();
+        if ((!file.empty()) && map_cache(file, store)) { return store; }
+    }
+
     png::image<png::rgb_pixel> image(spath_.c_str());
 
-    width_ = image.get_width();
-    height_ = image.get_height();
-    data_.reserve(width_ * height_);
+    store->width = image.get_width();
+    store->height = image.get_height();
+    store->data.reserve(store->width * store->height);
 
-    for (int i = 0; i < height_; i++) {
+    for (int i = 0; i < store->height; i++) {
         png::rgb_pixel *in = &image[i][0];
 
-        for (int j = 0; j < width_; j++, in++) {
+        for (int j = 0; j < store->width; j++, in++) {
             Pixel out(static_cast<float>(in->red), static_cast<float>(in->green), static_cast<float>(in->blue));
             out *= kByteToReal;
-            data_.push_back(out);
+            store->data.push_back(out);
         }
     }
+
+    store->offsets.assign(1, 0);
+    store->widths.assign(1, store->width);
+    store->heights.assign(1, store->height);
+    if (filter_ != tf_nearest) { build_mipmaps(store); }
+    arrange(store);
+
+    store->texels = (format_ == tx_float) ?
+                    reinterpret_cast<const unsigned char *>(store->data.data()) :
+                    store->bytes.data();
+    if (!file.empty()) { write_cache(file, store); }
+    return store;
 }
 
 /*
-Adds a texture to a texture collector or reuses
-one that already exists in the memory.
-Returns a pointer to the texture.
+Appends levels of the mip pyramid after the full
+texture, each half the size of the previous one, down
+to a single texel. Texels are averages of 2x2 blocks,
+the last row or column of odd sizes is dropped.
 */
-Texture *TextureCollector::add(const char *path) {
-    std::list<Texture>::iterator iter = textures_.begin();
-    std::list<Texture>::iterator iter_end = textures_.end();
+void Texture::build_mipmaps(TexelStore *store) {
+    int width = store->width;
+    int height = store->height;
+    int level = 0;
 
-    for (; iter != iter_end; ++iter) {
-        Texture *texture = &(*iter);
-        if (texture->check_path(path)) { return texture; }
+    size_t total = store->data.size();
+    for (int w = width, h = height; (w > 1) || (h > 1);) {
+        w = std::max(w / 2, 1);
+        h = std::max(h / 2, 1);
+        total += w * h;
     }
+    store->data.reserve(total);
+
+    while ((width > 1) || (height > 1)) {
+        int offset = store->offsets[level];
+        int nwidth = std::max(width / 2, 1);
+        int nheight = std::max(height / 2, 1);
+
+        store->offsets.push_back(static_cast<int>(store->data.size()));
+        store->widths.push_back(nwidth);
+        store->heights.push_back(nheight);
+
+        for (int y = 0; y < nheight; y++) {
+            int y0 = std::min(2 * y, height - 1);
+            int y1 = std::min(2 * y + 1, height - 1);
+
+            for (int x = 0; x < nwidth; x++) {
+                int x0 = std::min(2 * x, width - 1);
+                int x1 = std::min(2 * x + 1, width - 1);
+                Pixel sum = store->data[offset + x0 + y0 * width] + store->data[offset + x1 + y0 * width] +
+                            store->data[offset + x0 + y1 * width] + store->data[offset + x1 + y1 * width];
+                store->data.push_back(0.25f * sum);
+            }
+        }
+        width = nwidth;
+        height = nheight;
+        level++;
+    }
+}
+
+/*
+Rearranges all levels into the layout of the texture
+and converts them from floats to its format. Offsets of
+levels become offsets in bytes for compact formats.
+Blocks are arranged as single texels of a level a
+quarter of the size.
+
+Blocks hold 4x4 texels as two endpoint colors in 5:6:5
+bits and a 2-bit index per texel, which picks one of
+the endpoints or a color at a third or two thirds of
+the way between them.
+*/
+void Texture::arrange(TexelStore *store) {
+    int nlevels = static_cast<int>(store->offsets.size());
+    int unit = (format_ == tx_rgb8) ? 3 : (format_ == tx_rgba8) ? 4 : kBlockBytes;
+    std::vector<int> offsets(nlevels);
+    size_t total = 0;
+
+    store->strides.resize(nlevels);
+    store->spans.resize(nlevels);
+
+    for (int level = 0; level < nlevels; level++) {
+        int width = store->widths[level];
+        int height = store->heights[level];
+        if (format_ == tx_bc1) {
+            width = (width + kBlockSize - 1) / kBlockSize;
+            height = (height + kBlockSize - 1) / kBlockSize;
+        }
+        store->strides[level] = width;
+        offsets[level] = static_cast<int>(total);
+
+        size_t size = static_cast<size_t>(width) * height;
+        if (layout_ == tl_tiled) {
+            store->spans[level] = (width + kTileSize - 1) / kTileSize;
+            size = static_cast<size_t>(store->spans[level]) * kTileSize *
+                   (((height + kTileSize - 1) / kTileSize) * kTileSize);
+        } else if (layout_ == tl_morton) {
+            int bitsx = 0, bitsy = 0;
+            while ((1 << bitsx) < width) { bitsx++; }
+            while ((1 << bitsy) < height) { bitsy++; }
+            store->spans[level] = std::min(bitsx, bitsy);
+            size = static_cast<size_t>(1) << (bitsx + bitsy);
+        }
+        total += (format_ == tx_float) ? size : unit * size;
+    }
+
+    if (format_ == tx_float) {
+        if (layout_ == tl_linear) { return; }
+        std::vector<Pixel> data(total, Pixel(0.0f, 0.0f, 0.0f));
+
+        for (int level = 0; level < nlevels; level++) {
+            int width = store->widths[level];
+            const Pixel *in = &store->data[store->offsets[level]];
+
+            for (int y = 0; y < store->heights[level]; y++) {
+                for (int x = 0; x < width; x++) {
+                    data[offsets[level] + texel_index(store, level, x, y)] = in[x + y * width];
+                }
+            }
+        }
+        store->offsets = offsets;
+        store->data.swap(data);
+        return;
+    }
+
+    store->bytes.assign(total, 0);
+
+    for (int level = 0; level < nlevels; level++) {
+        int width = store->widths[level];
+        int height = store->heights[level];
+        unsigned char *out = &store->bytes[offsets[level]];
+
+        if (format_ == tx_bc1) {
+            for (int by = 0; by < height; by += kBlockSize) {
+                for (int bx = 0; bx < width; bx += kBlockSize) {
+                    int index = texel_index(store, level, bx / kBlockSize, by / kBlockSize);
+                    compress_block(store, level, bx, by, out + kBlockBytes * index);
+                }
+            }
+            continue;
+        }
+
+        const Pixel *in = &store->data[store->offsets[level]];
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++, in++) {
+                unsigned char *texel = out + unit * texel_index(store, level, x, y);
+                texel[0] = static_cast<unsigned char>(to_byte((*in)[0]));
+                texel[1] = static_cast<unsigned char>(to_byte((*in)[1]));
+                texel[2] = static_cast<unsigned char>(to_byte((*in)[2]));
+                if (format_ == tx_rgba8) { texel[3] = 255; }
+            }
+        }
+    }
+
+    store->offsets = offsets;
+    std::vector<Pixel>().swap(store->data);
+}
+
+/*
+Endpoints are the two texels of the block that lie
+furthest apart along the diagonal of its color box.
+Texels beyond the edges of the level repeat the last
+row or column.
+*/
+void Texture::compress_block(TexelStore *store, int level, int bx, int by,
+                             unsigned char *block) {
+    int width = store->widths[level];
+    int height = store->heights[level];
+    const Pixel *data = &store->data[store->offsets[level]];
+
+    Pixel colors[kBlockSize * kBlockSize];
+    Pixel lower(1.0f, 1.0f, 1.0f), upper(0.0f, 0.0f, 0.0f);
+
+    for (int j = 0; j < kBlockSize; j++) {
+        int y = std::min(by + j, height - 1);
+        for (int i = 0; i < kBlockSize; i++) {
+            int x = std::min(bx + i, width - 1);
+            Pixel color = data[x + y * width];
+            colors[i + j * kBlockSize] = color;
+            lower = lower.cwiseMin(color);
+            upper = upper.cwiseMax(color);
+        }
+    }
+
+    // Channels that fall as the widest one rises flip the diagonal
+    Pixel axis = upper - lower;
+    int widest;
+    axis.maxCoeff(&widest);
+    Pixel mean = 0.5f * (lower + upper);
+    Pixel covariance(0.0f, 0.0f, 0.0f);
+    for (int k = 0; k < kBlockSize * kBlockSize; k++) {
+        Pixel offset = colors[k] - mean;
+        covariance += offset[widest] * offset;
+    }
+    for (int c = 0; c < 3; c++) {
+        if (covariance[c] < 0.0f) { axis[c] = -axis[c]; }
+    }
+
+    int first = 0, second = 0;
+    float dmin = axis.dot(colors[0]), dmax = dmin;
+
+    for (int k = 1; k < kBlockSize * kBlockSize; k++) {
+        float d = axis.dot(colors[k]);
+        if (d < dmin) { dmin = d; first = k; }
+        if (d > dmax) { dmax = d; second = k; }
+    }
+
+    unsigned int c0 = pack_565(colors[first]);
+    unsigned int c1 = pack_565(colors[second]);
+    Pixel e0 = unpack_565(c0);
+    Pixel e1 = unpack_565(c1);
+
+    unsigned int bits = 0;
+    for (int k = 0; k < kBlockSize * kBlockSize; k++) {
+        unsigned int best = 0;
+        float error = 0.0f;
+
+        for (unsigned int index = 0; index < 4; index++) {
+            Pixel color = e0 + kBlockWeights[index] * (e1 - e0);
+            float e = (color - colors[k]).squaredNorm();
+            if ((index == 0) || (e < error)) { error = e; best = index; }
+        }
+        bits |= best << (2 * k);
+    }
+
+    block[0] = c0 & 0xff;
+    block[1] = c0 >> 8;
+    block[2] = c1 & 0xff;
+    block[3] = c1 >> 8;
+    block[4] = bits & 0xff;
+    block[5] = (bits >> 8) & 0xff;
+    block[6] = (bits >> 16) & 0xff;
+    block[7] = bits >> 24;
+}
+
+TextureCollector::TextureCollector() :
+    filter_(tf_nearest), format_(tx_float), layout_(tl_linear), loadtime_(0.0f),
+    lazy_(false), nthreads_(1), budget_(0), resident_(0), peak_(0), misses_(0),
+    evictions_(0) {}
+
+TextureCollector::~TextureCollector() {
+    for (size_t k = 0; k < retired_.size(); k++) { delete retired_[k].first; }
+}
+
+/*
+Filtering applies to textures loaded afterwards, which
+then get mip pyramids. Nearest lookups need none.
+*/
+void TextureCollector::set_filter(TextureFilter_t filter) {
+    filter_ = filter;
+}
+
+TextureFilter_t TextureCollector::get_filter() { return filter_; }
+
+/*
+Default format of textures that do not set their own.
+*/
+void TextureCollector::set_format(TexelFormat_t format) {
+    format_ = format;
+}
+
+TexelFormat_t TextureCollector::get_format() { return format_; }
+
+/*
+Layout of texels in memory of textures loaded afterwards.
+*/
+void TextureCollector::set_layout(TextureLayout_t layout) {
+    layout_ = layout;
+}
+
+/*
+Directory of decoded textures, created if missing. An
+empty directory turns caching off.
+*/
+void TextureCollector::set_cache(const char *directory) {
+    cache_ = directory;
+    if (!cache_.empty()) { mkdir(directory, 0755); }
+}
+
+/*
+Lazy textures are loaded by the thread that samples
+them first, instead of by load_pending.
+*/
+void TextureCollector::set_lazy(bool lazy) {
+    lazy_ = lazy;
+}
+
+/*
+Limit of bytes of resident texels, 0 for none. Under a
+budget textures are loaded on first use, and the least
+recently used ones are evicted to make room for others.
+*/
+void TextureCollector::set_budget(size_t bytes) {
+    budget_ = bytes;
+    residencyOn.store(bytes > 0);
+}
+
+bool TextureCollector::has_budget() { return budget_ > 0; }
+
+/*
+Threads that load pending textures: 0 (all available
+threads), 1 (serial), 2, 4, etc.
+*/
+void TextureCollector::set_threads(int nthreads) {
+    nthreads_ = nthreads;
+}
+
+/*
+Loads textures added since the last call, in parallel.
+Workers take the next texture from a shared counter.
+The persistent thread pool is used if it is running,
+OpenMP otherwise.
+*/
+void TextureCollector::load_pending() {
+    if (lazy_ || (budget_ > 0) || pending_.empty()) { return; }
+    MRTP_TRACE_SCOPE("load textures");
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::atomic<int> next(0);
+    int npending = static_cast<int>(pending_.size());
+
+    std::function<void()> task = [this, &next, npending] {
+        int k;
+        while ((k = next.fetch_add(1)) < npending) { pending_[k]->load_texture(); }
+    };
+
+    if ((nthreads_ == 1) || (npending == 1)) {
+        task();
+    } else if (threadPool.get_size() > 0) {
+        threadPool.run(task);
+    } else {
+#ifdef _OPENMP
+        int nthreads = (nthreads_ != 0) ? nthreads_ : omp_get_max_threads();
+#pragma omp parallel num_threads(std::min(nthreads, npending))
+        task();
+#else
+        task();
+#endif //_OPENMP
+    }
+    pending_.clear();
+
+    std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start;
+    loadtime_ += elapsed.count();
+}
+
+/*
+Registers a texture that was just loaded, which stays
+resident even if it alone is over budget.
+*/
+void TextureCollector::admit(Texture *texture, size_t bytes) {
+    std::lock_guard<std::mutex> lock(residency_);
+    residencyEpoch.fetch_add(1);
+    misses_++;
+    resident_ += bytes;
+    residents_.push_back(texture);
+
+    trim(texture);
+    reclaim();
+    peak_ = std::max(peak_, resident_);
+}
+
+/*
+Evicts the least recently used textures, other than
+keep, while over budget. Textures used since the last
+tile of any thread started stay, so that a tile does not
+evict what it samples. Threads still reading evicted
+texels keep them until their tile ends. Called with the
+residency lock held.
+*/
+void TextureCollector::trim(Texture *keep) {
+    unsigned long now = residencyClock.load(std::memory_order_relaxed);
+
+    while (resident_ > budget_) {
+        size_t victim = residents_.size();
+        for (size_t k = 0; k < residents_.size(); k++) {
+            if ((residents_[k] == keep) || (residents_[k]->get_last_use() >= now)) {
+                continue;
+            }
+            if ((victim == residents_.size()) ||
+                (residents_[k]->get_last_use() < residents_[victim]->get_last_use())) {
+                victim = k;
+            }
+        }
+        if (victim == residents_.size()) { break; }
+
+        TexelStore *store = residents_[victim]->evict();
+        residents_.erase(residents_.begin() + victim);
+        resident_ -= store->get_memory();
+        retired_.push_back(std::make_pair(store, residencyEpoch.fetch_add(1)));
+        evictions_++;
+    }
+}
+
+/*
+Called by rendering threads before each tile. Texels of
+textures evicted before this point can no longer be read
+by the calling thread once it returns.
+*/
+void TextureCollector::enter_reading() {
+    if (budget_ == 0) { return; }
+
+    if (!readerSlot) {
+        int slot = readerCount.fetch_add(1);
+        if (slot >= kMaxReaders) { return; }
+        readerSlot = &readerSlots[slot];
+    }
+    residencyClock.fetch_add(1, std::memory_order_relaxed);
+    readerSlot->epoch.store(residencyEpoch.load());
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    std::lock_guard<std::mutex> lock(residency_);
+    trim(nullptr);
+    reclaim();
+}
+
+/*
+Called by rendering threads when they have no more tiles.
+*/
+void TextureCollector::leave_reading() {
+    if ((budget_ == 0) || (!readerSlot)) { return; }
+
+    readerSlot->epoch.store(0);
+    std::lock_guard<std::mutex> lock(residency_);
+    reclaim();
+}
+
+/*
+Epoch at which the oldest tile being rendered started,
+or the largest epoch if no thread is reading. Threads
+beyond the slots count as reading since the start.
+*/
+unsigned long TextureCollector::oldest_reading() {
+    if (readerCount.load() > kMaxReaders) { return 0; }
+
+    unsigned long oldest = ~0UL;
+    int nslots = readerCount.load();
+    for (int k = 0; k < nslots; k++) {
+        unsigned long epoch = readerSlots[k].epoch.load();
+        if (epoch != 0) { oldest = std::min(oldest, epoch); }
+    }
+    return oldest;
+}
+
+/*
+Frees evicted texels that no reading thread may still
+hold. Called with the residency lock held.
+*/
+void TextureCollector::reclaim() {
+    if (retired_.empty()) { return; }
+
+    unsigned long oldest = oldest_reading();
+
+    size_t kept = 0;
+    for (size_t k = 0; k < retired_.size(); k++) {
+        if (retired_[k].second < oldest) {
+            delete retired_[k].first;
+        } else {
+            retired_[kept++] = retired_[k];
+        }
+    }
+    retired_.resize(kept);
+}
+
+int TextureCollector::get_count() { return static_cast<int>(textures_.size()); }
+
+int TextureCollector::get_loaded() {
+    int count = 0;
+    std::list<Texture>::iterator iter = textures_.begin();
+    for (; iter != textures_.end(); ++iter) { count += iter->is_loaded(); }
+    return count;
+}
+
+/*
+Bytes held by texels of all loaded textures, including
+mip levels.
+*/
+size_t TextureCollector::get_memory() {
+    size_t total = 0;
+    std::list<Texture>::iterator iter = textures_.begin();
+    for (; iter != textures_.end(); ++iter) { total += iter->get_memory(); }
+    return total;
+}
+
+/*
+Samples of resident textures, counted under a budget.
+*/
+long long TextureCollector::get_hits() {
+    long long total = 0;
+    int nslots = std::min(readerCount.load(), kMaxReaders);
+    for (int k = 0; k < nslots; k++) { total += readerSlots[k].hits; }
+    return total;
+}
+
+/*
+Loads of textures under a budget, including reloads of
+evicted ones.
+*/
+long long TextureCollector::get_misses() { return misses_; }
+
+long long TextureCollector::get_evictions() { return evictions_; }
+
+/*
+Most bytes of texels resident at once under a budget.
+*/
+size_t TextureCollector::get_peak() { return peak_; }
+
+/*
+Wall time of loading textures up front, or the sum of
+the load times of lazy textures, which are loaded by
+rendering threads.
+*/
+float TextureCollector::get_load_time() {
+    if ((!lazy_) && (budget_ == 0)) { return loadtime_; }
+
+    float total = 0.0f;
+    std::list<Texture>::iterator iter = textures_.begin();
+    for (; iter != textures_.end(); ++iter) { total += iter->get_load_time(); }
+    return total;
+}
+
+/*
+Adds a texture to a texture collector or reuses
+one that already exists in the same format. Returns
+a pointer to the texture, which is loaded later by
+load_pending or on its first sample.
+*/
+Texture *TextureCollector::add(const char *path, TexelFormat_t format) {
+    std::string key(path);
+    key += '|';
+    key += static_cast<char>('0' + format);
+
+    std::unordered_map<std::string, Texture *>::iterator found = index_.find(key);
+    if (found != index_.end()) { return found->second; }
 
-    Texture texture(path);
-    textures_.push_back(texture);
+    textures_.emplace_back(path, filter_, format, layout_,
+                           (cache_.empty()) ? nullptr : cache_.c_str());
     Texture *last = &textures_.back();
-    last->load_texture();
+    index_[key] = last;
+    pending_.push_back(last);
     return last;
 }
 
@@ -0,0 +1,139 @@
+/* File      : threadpool.cpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "threadpool.hpp"
+
+
+namespace mrtp {
+
+ThreadPool threadPool;
+
+
+ThreadPool::ThreadPool() : generation_(0), pending_(0), stopping_(false), pin_(pm_none) {}
+
+ThreadPool::~ThreadPool() { stop(); }
+
+/*
+Starts worker threads, which then wait for tasks until
+the pool is stopped. The pool is meant to live for the
+whole process. Calling start again with the same
+settings keeps the running threads.
+
+If nthreads=0, uses as many threads as available.
+*/
+void ThreadPool::start(int nthreads, PinMode_t pin) {
+    if (nthreads == 0) {
+        nthreads = static_cast<int>(std::thread::hardware_concurrency());
+        if (nthreads == 0) { nthreads = 1; }
+    }
+    if ((nthreads == get_size()) && (pin == pin_)) { return; }
+
+    stop();
+    stopping_ = false;
+    pin_ = pin;
+
+    // New workers only wake for tasks run after they were started
+    unsigned long seen;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        seen = generation_;
+    }
+    for (int i = 0; i < nthreads; i++) {
+        workers_.push_back(std::thread(&ThreadPool::work, this, seen));
+        pin_worker(i, nthreads);
+    }
+}
+
+void ThreadPool::stop() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+
+    std::vector<std::thread>::iterator iter = workers_.begin();
+    std::vector<std::thread>::iterator iter_end = workers_.end();
+
+    for (; iter != iter_end; ++iter) {
+        iter->join();
+    }
+    workers_.clear();
+}
+
+int ThreadPool::get_size() { return static_cast<int>(workers_.size()); }
+
+PinMode_t ThreadPool::get_pin() { return pin_; }
+
+/*
+Runs a task on every worker and returns when
+all of them have finished.
+*/
+void ThreadPool::run(std::function<void()> task) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    task_ = task;
+    pending_ = get_size();
+    generation_++;
+    wake_.notify_all();
+
+    done_.wait(lock, [this] { return pending_ == 0; });
+    task_ = nullptr;
+}
+
+void ThreadPool::work(unsigned long seen) {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [this, seen] { return stopping_ || (generation_ != seen); });
+            if (stopping_) { return; }
+            seen = generation_;
+            task = task_;
+        }
+
+        task();
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (--pending_ == 0) { done_.notify_one(); }
+    }
+}
+
+/*
+Binds a worker to one of the CPUs the process may run on:
+  compact  worker i goes to the i-th CPU
+  scatter  workers are spread evenly over all CPUs
+*/
+void ThreadPool::pin_worker(int index, int nthreads) {
+#ifdef __linux__
+    if (pin_ == pm_none) { return; }
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) { return; }
+
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) { cpus.push_back(cpu); }
+    }
+    if (cpus.empty()) { return; }
+
+    int ncpus = static_cast<int>(cpus.size());
+    int slot = index % ncpus;
+    if (pin_ == pm_scatter) {
+        slot = (index * ncpus / nthreads) % ncpus;
+    }
+
+    cpu_set_t target;
+    CPU_ZERO(&target);
+    CPU_SET(cpus[slot], &target);
+    pthread_setaffinity_np(workers_[index].native_handle(), sizeof(target), &target);
+#endif
+}
+
+} //namespace mrtp
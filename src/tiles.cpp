@@ -0,0 +1,106 @@
+/* File      : tiles.cpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "tiles.hpp"
+
+
+namespace mrtp {
+
+//Local functions
+
+/*
+Distance of cell (x, y) along a Hilbert curve filling
+an n x n grid, n being a power of two.
+*/
+static long hilbert_index(long n, long x, long y) {
+    long d = 0;
+
+    for (long s = n / 2; s > 0; s /= 2) {
+        long rx = (x & s) > 0;
+        long ry = (y & s) > 0;
+        d += s * s * ((3 * rx) ^ ry);
+
+        // Rotate the quadrant
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+/*
+Position of cell (x, y) on a square spiral winding out
+of the cell (cx, cy): first by ring, then by angle.
+*/
+static double spiral_index(int x, int y, int cx, int cy) {
+    int dx = x - cx;
+    int dy = y - cy;
+    int ring = std::max(std::abs(dx), std::abs(dy));
+    double angle = std::atan2(static_cast<double>(dy), static_cast<double>(dx));
+
+    return ring * 8.0 + (angle + M_PI) / M_PI;
+}
+
+//Functions
+
+/*
+Splits the frame into square tiles of the given size.
+Tiles at the right and bottom edges may be smaller.
+
+Tiles are listed in the order they should be handed
+out to threads:
+  scanline  rows from top to bottom
+  hilbert   along a Hilbert curve, keeps neighbours close
+  spiral    from the center outwards, the most interesting
+            part of the frame comes first
+*/
+void generate_tiles(int width, int height, int size, TileOrder_t order,
+                    std::vector<Tile> *tiles) {
+    int nx = (width + size - 1) / size;
+    int ny = (height + size - 1) / size;
+    std::vector<std::pair<double, Tile> > keyed;
+
+    long n = 1;
+    while ((n < nx) || (n < ny)) { n *= 2; }
+
+    for (int j = 0; j < ny; j++) {
+        for (int i = 0; i < nx; i++) {
+            Tile tile;
+            tile.x = i * size;
+            tile.y = j * size;
+            tile.xend = std::min(tile.x + size, width);
+            tile.yend = std::min(tile.y + size, height);
+
+            double key = static_cast<double>(j * nx + i);
+            if (order == to_hilbert) {
+                key = static_cast<double>(hilbert_index(n, i, j));
+            } else if (order == to_spiral) {
+                key = spiral_index(i, j, nx / 2, ny / 2);
+            }
+            keyed.push_back(std::make_pair(key, tile));
+        }
+    }
+
+    std::stable_sort(keyed.begin(), keyed.end(),
+        [](const std::pair<double, Tile> &a, const std::pair<double, Tile> &b) {
+            return a.first < b.first;
+        });
+
+    tiles->clear();
+    tiles->reserve(keyed.size());
+    for (size_t i = 0; i < keyed.size(); i++) {
+        tiles->push_back(keyed[i].second);
+    }
+}
+
+} //namespace mrtp
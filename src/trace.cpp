@@ -0,0 +1,124 @@
+/* File      : trace.cpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#ifdef MRTP_TRACE
+
+#include <fstream>
+#include <iomanip>
+#include <string>
+
+#include "trace.hpp"
+
+
+namespace mrtp {
+
+Tracer tracer;
+
+static thread_local TraceBuffer *traceBuffer = nullptr;
+
+
+static std::string quote(const char *text) {
+    std::string quoted = "\"";
+    for (; *text; text++) {
+        if ((*text == '"') || (*text == '\\')) { quoted += '\\'; }
+        quoted += *text;
+    }
+    return quoted + "\"";
+}
+
+Tracer::Tracer() : enabled_(false) {}
+
+/*
+Starts recording, called before any thread to be traced
+is busy. The calling thread is shown as the main thread.
+*/
+void Tracer::start() {
+    origin_ = std::chrono::steady_clock::now();
+    enabled_ = true;
+    add_buffer();
+}
+
+/*
+Nanoseconds since start.
+*/
+long long Tracer::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - origin_).count();
+}
+
+/*
+Adds an event that began at start and ends now to the
+ring of the calling thread. The lock is only taken when
+a thread records its first event.
+*/
+void Tracer::record(const char *name, const char *text, long long arg, long long start) {
+    TraceBuffer *buffer = (traceBuffer) ? traceBuffer : add_buffer();
+
+    TraceEvent *event = &buffer->events[buffer->count % kTraceEvents];
+    event->name = name;
+    event->text = text;
+    event->arg = arg;
+    event->start = start;
+    event->duration = now() - start;
+    buffer->count++;
+}
+
+TraceBuffer *Tracer::add_buffer() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffers_.emplace_back();
+    traceBuffer = &buffers_.back();
+    traceBuffer->tid = static_cast<int>(buffers_.size()) - 1;
+    traceBuffer->count = 0;
+    traceBuffer->events.resize(kTraceEvents);
+    return traceBuffer;
+}
+
+/*
+Writes events of all threads as complete events, in
+microseconds, once no thread is recording. Threads that
+overflowed their ring lose their oldest events, which is
+noted in the name of the thread.
+*/
+bool Tracer::write(const char *path) {
+    std::ofstream file(path);
+    if (!file) { return false; }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    file << std::fixed << std::setprecision(3) << "{\"traceEvents\": [";
+    bool first = true;
+
+    std::list<TraceBuffer>::iterator iter = buffers_.begin();
+    for (; iter != buffers_.end(); ++iter) {
+        std::string name = (iter->tid == 0) ? "main" : "worker " + std::to_string(iter->tid);
+        long long dropped = (iter->count > kTraceEvents) ? iter->count - kTraceEvents : 0;
+        if (dropped > 0) { name += " (" + std::to_string(dropped) + " events dropped)"; }
+
+        file << ((first) ? "\n" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", "
+             << "\"pid\": 1, \"tid\": " << iter->tid << ", \"args\": {\"name\": "
+             << quote(name.c_str()) << "}}";
+        first = false;
+
+        for (long long k = dropped; k < iter->count; k++) {
+            TraceEvent *event = &iter->events[k % kTraceEvents];
+            file << ",\n{\"name\": " << quote(event->name) << ", \"cat\": \"mrtp\", "
+                 << "\"ph\": \"X\", \"pid\": 1, \"tid\": " << iter->tid << ", \"ts\": "
+                 << 1.0e-3 * event->start << ", \"dur\": " << 1.0e-3 * event->duration;
+            if (event->text || (event->arg >= 0)) {
+                file << ", \"args\": {";
+                if (event->text) { file << "\"name\": " << quote(event->text); }
+                if (event->text && (event->arg >= 0)) { file << ", "; }
+                if (event->arg >= 0) { file << "\"index\": " << event->arg; }
+                file << "}";
+            }
+            file << "}";
+        }
+    }
+    file << "\n], \"displayTimeUnit\": \"ms\"}" << std::endl;
+    return static_cast<bool>(file);
+}
+
+} //namespace mrtp
+
+#endif //MRTP_TRACE
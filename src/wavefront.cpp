@@ -0,0 +1,343 @@
+/* File      : wavefront.cpp
+ * Program   : mrtp
+ * Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+ * License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+ */
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+#include "renderer.hpp"
+
+
+namespace mrtp {
+
+static const float kKeyScale = 1023.0f;
+
+/*
+Sort key of a direction: its octant, followed by the
+quantized x and y components.
+*/
+static unsigned int direction_key(Eigen::Vector3f *direction) {
+    unsigned int octant = ((*direction)[0] < 0.0f) | (((*direction)[1] < 0.0f) << 1) |
+                          (((*direction)[2] < 0.0f) << 2);
+    unsigned int qx = static_cast<unsigned int>(((*direction)[0] + 1.0f) * 0.5f * kKeyScale);
+    unsigned int qy = static_cast<unsigned int>(((*direction)[1] + 1.0f) * 0.5f * kKeyScale);
+    return (octant << 20) | (qx << 10) | qy;
+}
+
+WaveRay::WaveRay() :
+    origin(Eigen::Vector3f::Zero()), direction(Eigen::Vector3f::Zero()), path(0), depth(0),
+    parent(nullptr), hit(nullptr), currd(0.0f), inter(Eigen::Vector3f::Zero()),
+    normal(Eigen::Vector3f::Zero()), corr(Eigen::Vector3f::Zero()),
+    tolight(Eigen::Vector3f::Zero()), lightd(0.0f), intensity(0.0f), isshadow(false),
+    footprint(0.0f), local(Pixel::Zero()) {}
+
+/*
+Queues are kept by each thread and reused between tiles.
+*/
+static thread_local std::vector<WaveRay> waveRays;
+static thread_local std::vector<WaveRay> waveNext;
+static thread_local std::vector<int> waveLit;
+static thread_local std::vector<WaveStep> waveSteps;
+static thread_local std::vector<int> waveEnds;
+static thread_local std::vector<std::pair<unsigned long long, int> > waveOrder;
+
+/*
+Renders a tile in stages instead of one ray at a time:
+primary rays of the whole tile are queued, then
+intersected, prepared for shading, tested for shadows
+and shaded, each stage as a batch over the queue.
+Reflected rays are collected into a new, compacted
+queue, which goes through the same stages, until no
+rays are left or maxdepth is reached.
+
+Shading of each step is kept per path, and combined
+from the deepest step up at the end, so that pixels
+match those of trace_ray_r.
+*/
+void Renderer::render_tile_wavefront(Tile *tile) {
+    Camera *camera = world_->ptr_camera_;
+    int width = tile->xend - tile->x;
+    int height = tile->yend - tile->y;
+    int npaths = width * height;
+    int nsteps = maxdepth_ + 1;
+
+    std::vector<WaveRay> &rays = waveRays;
+    std::vector<WaveRay> &next = waveNext;
+    std::vector<int> &lit = waveLit;
+    std::vector<WaveStep> &steps = waveSteps;
+    std::vector<int> &ends = waveEnds;
+
+    rays.clear();
+    steps.resize(npaths * nsteps);
+    ends.assign(npaths, 0);
+
+    // Queue primary rays in blocks of packet size for coherence
+    int bwidth = 1, bheight = 1;
+    if (packetsize_ > 1) { packet_shape(packetsize_, &bwidth, &bheight); }
+
+    for (int bj = 0; bj < height; bj += bheight) {
+        for (int bi = 0; bi < width; bi += bwidth) {
+            for (int j = bj; (j < bj + bheight) && (j < height); j++) {
+                for (int i = bi; (i < bi + bwidth) && (i < width); i++) {
+                    WaveRay ray;
+                    ray.origin = camera->calculate_origin(tile->x + i, tile->y + j);
+                    ray.direction = camera->calculate_direction(&ray.origin);
+                    ray.path = j * width + i;
+                    ray.depth = 0;
+                    ray.parent = nullptr;
+                    rays.push_back(ray);
+                }
+            }
+        }
+    }
+
+    while (!rays.empty()) {
+        wave_intersect(&rays);
+
+        if ((rays[0].depth == 0) && (!hitbuffer_.empty())) {
+            for (size_t k = 0; k < rays.size(); k++) {
+                int path = rays[k].path;
+                size_t index = static_cast<size_t>(tile->y + path / width) * width_ +
+                               tile->x + path % width;
+                hitbuffer_[index] = rays[k].hit;
+            }
+        }
+
+        wave_prepare(&rays, &lit);
+        wave_shadows(&rays, &lit);
+
+        next.clear();
+        wave_shade(&rays, &steps, &ends, &next);
+        if (raysort_ != so_none) {
+            // Rays of this bounce are done, their queue is free
+            wave_sort(&next, &rays);
+        }
+        rays.swap(next);
+    }
+
+    for (int path = 0; path < npaths; path++) {
+        WaveStep *step = &steps[path * nsteps];
+        Pixel pixel = step[ends[path]].local;
+
+        for (int depth = ends[path] - 1; depth >= 0; depth--) {
+            float coeff = step[depth].coeff;
+            pixel = (1.0f - coeff) * pixel + coeff * step[depth].local;
+        }
+        size_t index = static_cast<size_t>(tile->y + path / width) * width_ + tile->x + path % width;
+        framebuffer_[index] = pixel;
+    }
+}
+
+/*
+Finds the closest hit of each queued ray, in packets
+if enabled. The last packet may be partly empty.
+*/
+void Renderer::wave_intersect(std::vector<WaveRay> *rays) {
+    int nrays = static_cast<int>(rays->size());
+
+    if (packetsize_ <= 1) {
+        for (int k = 0; k < nrays; k++) {
+            WaveRay *ray = &(*rays)[k];
+            ray->currd = maxdist_;
+            ray->hit = solve_hits(&ray->origin, &ray->direction, &ray->currd);
+            count_ray(ray->depth, ray->hit != nullptr);
+        }
+        return;
+    }
+
+    RayPacket packet;
+    packet.size = packetsize_;
+
+    for (int first = 0; first < nrays; first += packetsize_) {
+        for (int i = 0; i < packetsize_; i++) {
+            int k = ((first + i) < nrays) ? (first + i) : first;
+            WaveRay *ray = &(*rays)[k];
+
+            packet.active[i] = (first + i) < nrays;
+            packet.ox[i] = ray->origin[0];
+            packet.oy[i] = ray->origin[1];
+            packet.oz[i] = ray->origin[2];
+            packet.dx[i] = ray->direction[0];
+            packet.dy[i] = ray->direction[1];
+            packet.dz[i] = ray->direction[2];
+            packet.maxd[i] = maxdist_;
+            packet.currd[i] = maxdist_;
+            packet.hit[i] = nullptr;
+        }
+        packet_prepare(&packet);
+        world_->bvh_.solve_hits_packet(&packet);
+
+        for (int i = 0; (i < packetsize_) && (first + i < nrays); i++) {
+            WaveRay *ray = &(*rays)[first + i];
+            ray->hit = packet.hit[i];
+            ray->currd = packet.currd[i];
+            count_ray(ray->depth, ray->hit != nullptr);
+        }
+    }
+}
+
+/*
+Computes intersections, normals and rays to the light.
+On output, lit holds the rays facing the light, which
+need a shadow test. Scenes with several lights are
+shaded here instead.
+*/
+void Renderer::wave_prepare(std::vector<WaveRay> *rays, std::vector<int> *lit) {
+    int nrays = static_cast<int>(rays->size());
+    lit->clear();
+
+    for (int k = 0; k < nrays; k++) {
+        WaveRay *ray = &(*rays)[k];
+        ray->intensity = 0.0f;
+        ray->isshadow = false;
+        if (!ray->hit) { continue; }
+
+        ray->inter = (ray->direction * ray->currd) + ray->origin;
+        ray->normal = ray->hit->calculate_normal(&ray->inter);
+        ray->footprint = calculate_footprint(&ray->origin, &ray->direction, ray->currd,
+                                             &ray->normal);
+
+        if (manylights_) {
+            // Shadows of several lights are tested right away
+            bool shaded;
+            ray->corr = ray->inter + bias_ * ray->normal;
+            ray->local = shade_lights(ray->hit, &ray->inter, &ray->normal, &ray->corr,
+                                      ray->footprint, &shaded);
+            ray->intensity = (shaded) ? 1.0f : 0.0f;
+            continue;
+        }
+
+        ray->tolight = world_->ptr_light_->calculate_ray(&ray->inter);
+        ray->lightd = ray->tolight.norm();
+        ray->tolight *= (1.0f / ray->lightd);
+        ray->intensity = ray->tolight.dot(ray->normal);
+
+        if (ray->intensity > 0.0f) {
+            ray->corr = ray->inter + bias_ * ray->normal;
+            lit->push_back(k);
+        }
+    }
+}
+
+/*
+Tests the rays listed in lit for shadows, in packets
+if enabled.
+*/
+void Renderer::wave_shadows(std::vector<WaveRay> *rays, std::vector<int> *lit) {
+    int nlit = static_cast<int>(lit->size());
+
+    if (packetsize_ <= 1) {
+        for (int k = 0; k < nlit; k++) {
+            WaveRay *ray = &(*rays)[(*lit)[k]];
+            ray->isshadow = solve_shadows(&ray->corr, &ray->tolight, ray->lightd);
+        }
+        return;
+    }
+
+    RayPacket packet;
+    packet.size = packetsize_;
+
+    for (int first = 0; first < nlit; first += packetsize_) {
+        for (int i = 0; i < packetsize_; i++) {
+            int k = ((first + i) < nlit) ? (first + i) : first;
+            WaveRay *ray = &(*rays)[(*lit)[k]];
+
+            packet.active[i] = (first + i) < nlit;
+            packet.ox[i] = ray->corr[0];
+            packet.oy[i] = ray->corr[1];
+            packet.oz[i] = ray->corr[2];
+            packet.dx[i] = ray->tolight[0];
+            packet.dy[i] = ray->tolight[1];
+            packet.dz[i] = ray->tolight[2];
+            packet.maxd[i] = ray->lightd;
+            packet.currd[i] = ray->lightd;
+            packet.hit[i] = nullptr;
+        }
+        packet_prepare(&packet);
+        solve_shadows_packet(&packet);
+
+        for (int i = 0; (i < packetsize_) && (first + i < nlit); i++) {
+            (*rays)[(*lit)[first + i]].isshadow = packet.hit[i] != nullptr;
+        }
+    }
+}
+
+/*
+Shades each ray and queues reflected rays of reflective
+actors into next. Rays that miss or face away from the
+light end their path in black, as in trace_ray_r.
+*/
+void Renderer::wave_shade(std::vector<WaveRay> *rays, std::vector<WaveStep> *steps,
+                          std::vector<int> *ends, std::vector<WaveRay> *next) {
+    int nrays = static_cast<int>(rays->size());
+    int nsteps = maxdepth_ + 1;
+
+    for (int k = 0; k < nrays; k++) {
+        WaveRay *ray = &(*rays)[k];
+        WaveStep *step = &(*steps)[ray->path * nsteps + ray->depth];
+        (*ends)[ray->path] = ray->depth;
+
+        step->local << 0.0f, 0.0f, 0.0f;
+        step->coeff = 0.0f;
+        if ((!ray->hit) || (ray->intensity <= 0.0f)) { continue; }
+
+        if (manylights_) {
+            step->local = ray->local;
+        } else {
+            step->local = shade_local(ray->hit, &ray->inter, &ray->normal, ray->lightd,
+                                      ray->intensity, ray->isshadow, ray->footprint);
+        }
+
+        if (ray->depth < maxdepth_) {
+            float coeff = ray->hit->get_reflect();
+            if (coeff > 0.0f) {
+                step->coeff = coeff;
+
+                WaveRay reflected;
+                reflected.origin = ray->corr;
+                reflected.direction = ray->direction -
+                                      (2.0f * ray->direction.dot(ray->normal)) * ray->normal;
+                reflected.path = ray->path;
+                reflected.depth = ray->depth + 1;
+                reflected.parent = ray->hit;
+                next->push_back(reflected);
+            }
+        }
+    }
+}
+
+/*
+Sorts reflected rays by the actor they come from or by
+direction, so that packets of the next bounce hold
+similar rays. Results do not depend on the order.
+
+Keys are sorted along with ray indices, rays are then
+copied once into scratch in the sorted order.
+*/
+void Renderer::wave_sort(std::vector<WaveRay> *rays, std::vector<WaveRay> *scratch) {
+    int nrays = static_cast<int>(rays->size());
+    if (nrays <= 1) { return; }
+
+    std::vector<std::pair<unsigned long long, int> > &order = waveOrder;
+    order.resize(nrays);
+
+    for (int k = 0; k < nrays; k++) {
+        WaveRay *ray = &(*rays)[k];
+        unsigned long long key = (raysort_ == so_actor) ?
+            static_cast<unsigned long long>(reinterpret_cast<std::uintptr_t>(ray->parent)) :
+            direction_key(&ray->direction);
+        order[k] = std::make_pair(key, k);
+    }
+    std::sort(order.begin(), order.end());
+
+    scratch->resize(nrays);
+    for (int k = 0; k < nrays; k++) {
+        (*scratch)[k] = (*rays)[order[k].second];
+    }
+    rays->swap(*scratch);
+}
+
+} //namespace mrtp
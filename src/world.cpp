@@ -5,6 +5,7 @@
  */
 #include <fstream>
 
+#include "trace.hpp"
 #include "world.hpp"
 
 
@@ -26,12 +27,21 @@ static bool read_vector(std::shared_ptr<cpptoml::table> items, const char *id,
     return true;
 }
 
-static bool read_texture(std::shared_ptr<cpptoml::table> items, std::string *output) {
+/*
+The texel format is optional and overrides the default
+one of the texture collector.
+*/
+static bool read_texture(std::shared_ptr<cpptoml::table> items, std::string *output,
+                         TexelFormat_t *format) {
     auto raw = items->get_as<std::string>("texture");
     if (!raw) { return false; }
     const char *texture = raw->data();
     if (!file_exists(texture)) { return false; }
     *output = texture;
+
+    *format = textureCollector.get_format();
+    auto raw_format = items->get_as<std::string>("texture_format");
+    if (raw_format && !parse_texel_format(raw_format->data(), format)) { return false; }
     return true;
 }
 
@@ -42,10 +52,14 @@ World::World(const char *path) : path_(path) {}
 World::~World() {}
 
 WorldStatus_t World::initialize() {
+    MRTP_TRACE_SCOPE("initialize world");
     if (!file_exists(path_)) { return ws_no_file; }
 
     std::shared_ptr<cpptoml::table> config;
-    try { config = cpptoml::parse_file(path_); } catch (...) { return ws_parse_error; }
+    try {
+        MRTP_TRACE_SCOPE("parse toml");
+        config = cpptoml::parse_file(path_);
+    } catch (...) { return ws_parse_error; }
 
     auto tab_camera = config->get_table("camera");
     if (!tab_camera) { return ws_no_camera; }
@@ -67,20 +81,18 @@ WorldStatus_t World::initialize() {
     cameras_.push_back(camera);
     ptr_camera_ = &cameras_.back();
 
-    auto tab_light = config->get_table("light");
-    if (!tab_light) { return ws_no_light; }
-
-    auto raw_center = tab_light->get_array_of<double>("center");
-    if (!raw_center) { return ws_light_param; }
+    WorldStatus_t check;
 
-    Eigen::Vector3d temp_center(raw_center->data());
-    Eigen::Vector3f light_center = temp_center.cast<float>();
+    // A single [light] table, [[lights]] arrays, or both
+    auto tab_light = config->get_table("light");
+    if (tab_light && (check = load_light(tab_light)) != ws_ok) { return check; }
 
-    Light light(&light_center);
-    lights_.push_back(light);
-    ptr_light_ = &lights_.back();
+    auto lights = config->get_table_array("lights");
+    if ((check = load_lights(lights)) != ws_ok) { return check; }
 
-    WorldStatus_t check;
+    if (ptr_lights_.empty()) { return ws_no_light; }
+    ptr_light_ = ptr_lights_.front();
+    lighttree_.build(&ptr_lights_);
 
     auto planes = config->get_table_array("planes");
     if ((check = load_planes(planes)) != ws_ok) { return check; }
@@ -93,6 +105,30 @@ WorldStatus_t World::initialize() {
 
     if (ptr_actors_.empty()) { return ws_no_actors; }
 
+    // Textures of all actors are loaded together
+    textureCollector.load_pending();
+
+    bvh_.build(&ptr_actors_);
+
+    // Shadow rays only need actors that cast shadows
+    std::vector<Actor *> casters;
+    std::vector<Actor *>::iterator iter = ptr_actors_.begin();
+    std::vector<Actor *>::iterator iter_end = ptr_actors_.end();
+
+    for (; iter != iter_end; ++iter) {
+        if ((*iter)->has_shadow()) { casters.push_back(*iter); }
+    }
+    occluders_.build(&casters);
+
+    return ws_ok;
+}
+
+WorldStatus_t World::load_lights(std::shared_ptr<cpptoml::table_array> array) {
+    if (!array) { return ws_ok; }
+    for (const auto& items : *array) {
+        WorldStatus_t check;
+        if ((check = load_light(items)) != ws_ok) { return check; }
+    }
     return ws_ok;
 }
 
@@ -123,6 +159,20 @@ WorldStatus_t World::load_cylinders(std::shared_ptr<cpptoml::table_array> array)
     return ws_ok;
 }
 
+WorldStatus_t World::load_light(std::shared_ptr<cpptoml::table> items) {
+    Eigen::Vector3f center;
+    if (!read_vector(items, "center", &center)) { return ws_light_param; }
+
+    float power = static_cast<float>(items->get_as<double>("power").value_or(1.0f));
+    if (power < 0.0f) { return ws_light_param; }
+
+    Light light(&center, power);
+    lights_.push_back(light);
+    ptr_lights_.push_back(&lights_.back());
+
+    return ws_ok;
+}
+
 WorldStatus_t World::load_plane(std::shared_ptr<cpptoml::table> items) {
     Eigen::Vector3f center;
     if (!read_vector(items, "center", &center)) { return ws_plane_param; }
@@ -131,12 +181,13 @@ WorldStatus_t World::load_plane(std::shared_ptr<cpptoml::table> items) {
     if (!read_vector(items, "normal", &normal)) { return ws_plane_param; }
 
     std::string texture;
-    if (!read_texture(items, &texture)) { return ws_plane_texture; }
+    TexelFormat_t format;
+    if (!read_texture(items, &texture, &format)) { return ws_plane_texture; }
 
     float scale = static_cast<float>(items->get_as<double>("scale").value_or(0.15f));
     float reflect = static_cast<float>(items->get_as<double>("reflect").value_or(0.0f));
 
-    Plane plane(&center, &normal, scale, reflect, texture.c_str());
+    Plane plane(&center, &normal, scale, reflect, texture.c_str(), format);
     planes_.push_back(plane);
     ptr_actors_.push_back(&planes_.back());
 
@@ -151,12 +202,13 @@ WorldStatus_t World::load_sphere(std::shared_ptr<cpptoml::table> items) {
     read_vector(items, "axis", &axis);
 
     std::string texture;
-    if (!read_texture(items, &texture)) { return ws_sphere_texture; }
+    TexelFormat_t format;
+    if (!read_texture(items, &texture, &format)) { return ws_sphere_texture; }
 
     float radius = static_cast<float>(items->get_as<double>("radius").value_or(1.0f));
     float reflect = static_cast<float>(items->get_as<double>("reflect").value_or(0.0f));
 
-    Sphere sphere(&center, radius, &axis, reflect, texture.c_str());
+    Sphere sphere(&center, radius, &axis, reflect, texture.c_str(), format);
     spheres_.push_back(sphere);
     ptr_actors_.push_back(&spheres_.back());
 
@@ -171,13 +223,14 @@ WorldStatus_t World::load_cylinder(std::shared_ptr<cpptoml::table> items) {
     if (!read_vector(items, "direction", &direction)) { return ws_cylinder_param; }
 
     std::string texture;
-    if (!read_texture(items, &texture)) { return ws_cylinder_texture; }
+    TexelFormat_t format;
+    if (!read_texture(items, &texture, &format)) { return ws_cylinder_texture; }
 
     float span = static_cast<float>(items->get_as<double>("span").value_or(-1.0f));
     float radius = static_cast<float>(items->get_as<double>("radius").value_or(1.0f));
     float reflect = static_cast<float>(items->get_as<double>("reflect").value_or(0.0f));
 
-    Cylinder cylinder(&center, &direction, radius, span, reflect, texture.c_str());
+    Cylinder cylinder(&center, &direction, radius, span, reflect, texture.c_str(), format);
     cylinders_.push_back(cylinder);
     ptr_actors_.push_back(&cylinders_.back());
 
@@ -0,0 +1,39 @@
+#!/bin/sh
+# File      : run.sh
+# Program   : mrtp
+# Copyright : Mikolaj Feliks  <mikolaj.feliks@gmail.com>
+# License   : LGPL v3  (http://www.gnu.org/licenses/gpl-3.0.en.html)
+#
+# Renders the scenes of this directory with the renderer given as the
+# first argument and checks what they are meant to show. Run from tests/.
+
+CLI=${1:-../bin/mrtp_cli}
+OUT=$(mktemp -d)
+FAILED=0
+
+fail() {
+    echo "FAIL: $1"
+    FAILED=1
+}
+
+# Resident textures stay within the budget with several threads,
+# as no tile of budget.toml samples more than one texture
+for threads in 1 2 4; do
+    peak=$($CLI budget.toml -o $OUT/budget.png -S -t $threads -M 2 |
+           sed -n 's/.*texture residency:.* peak \([0-9.]*\) MB.*/\1/p')
+    if [ -z "$peak" ] || ! awk -v peak="$peak" 'BEGIN { exit !(peak <= 2.0) }'; then
+        fail "texture budget of 2 MB with $threads threads, peak ${peak:-unknown} MB"
+    fi
+done
+
+# The power of a single light scales its brightness
+sed -e 's/^power = .*/power = 1.0/' -e "s|\.\./textures|$PWD/../textures|" power.toml > $OUT/full.toml
+$CLI power.toml -o $OUT/power.ppm > /dev/null
+$CLI $OUT/full.toml -o $OUT/full.ppm > /dev/null
+if [ ! -s $OUT/power.ppm ] || [ ! -s $OUT/full.ppm ] || cmp -s $OUT/power.ppm $OUT/full.ppm; then
+    fail "single light at power 0.3 renders as at power 1"
+fi
+
+rm -r $OUT
+[ $FAILED -eq 0 ] && echo "all tests passed"
+exit $FAILED